@@ -0,0 +1,34 @@
+// Project Identifier: C0F4DFE8B340D81183C208F70F9D2D797908754D
+
+// SillyQL blocked Bloom filter, see BloomFilter.h
+
+#include "BloomFilter.h"
+
+// odd multipliers, one per word, that spread one 32 bit hash into eight
+// independent bit positions (the ones Parquet's split block filter uses)
+static constexpr uint32_t SALTS[8] = {0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+                                      0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U};
+
+BloomFilter::BloomFilter(size_t expected_keys)
+    : blocks((expected_keys * BITS_PER_KEY + sizeof(Block) * 8 - 1) / (sizeof(Block) * 8) + 1, Block{}) {}
+
+uint32_t BloomFilter::bit_in_word(uint64_t hash, size_t word) noexcept {
+  // the top 5 bits of the product pick one of the word's 32 bits
+  return uint32_t{1} << ((static_cast<uint32_t>(hash) * SALTS[word]) >> 27);
+}
+
+void BloomFilter::insert(uint64_t hash) noexcept {
+  Block& block = blocks[block_index(hash)];
+  for (size_t w = 0; w < BLOCK_WORDS; ++w)
+    block.words[w] |= bit_in_word(hash, w);
+}
+
+bool BloomFilter::may_contain(uint64_t hash) const noexcept {
+  const Block& block = blocks[block_index(hash)];
+  // no early exit: all eight words share the cache line, and a branch per
+  // word mispredicts more than it saves
+  uint32_t missing = 0;
+  for (size_t w = 0; w < BLOCK_WORDS; ++w)
+    missing |= bit_in_word(hash, w) & ~block.words[w];
+  return missing == 0;
+}
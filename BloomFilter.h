@@ -0,0 +1,47 @@
+// Project Identifier: C0F4DFE8B340D81183C208F70F9D2D797908754D
+
+// SillyQL blocked Bloom filter: a compact "definitely not there / maybe
+// there" answer for a set of keys, given by their 64 bit hashes. Each key
+// sets 8 bits inside one 32 byte block, one in each 32 bit word, so a lookup
+// touches a single cache line instead of one per bit. At 12 bits per key
+// about 1 in 200 keys that were never inserted slips through.
+//
+// A JOIN builds one over the keys of the side it hashes and checks every
+// probe key against it first, so rows without a partner never reach the
+// much larger hash map. Nothing in it is specific to JOIN; any semi-join
+// style filter can use it the same way.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+class BloomFilter {
+  public:
+  // sized for about expected_keys distinct keys
+  explicit BloomFilter(size_t expected_keys);
+
+  void insert(uint64_t hash) noexcept;
+  // false only if hash was never inserted
+  bool may_contain(uint64_t hash) const noexcept;
+
+  size_t size_bytes() const noexcept { return blocks.size() * sizeof(Block); }
+
+  private:
+  static constexpr size_t BITS_PER_KEY = 12;
+  static constexpr size_t BLOCK_WORDS = 8;
+
+  struct alignas(32) Block {
+    uint32_t words[BLOCK_WORDS];
+  };
+
+  std::vector<Block> blocks;
+
+  // the high half of the hash picks the block, the low half the bits in it
+  size_t block_index(uint64_t hash) const noexcept {
+    return static_cast<size_t>(((hash >> 32) * blocks.size()) >> 32);
+  }
+  static uint32_t bit_in_word(uint64_t hash, size_t word) noexcept;
+};
@@ -0,0 +1,203 @@
+// Project Identifier: C0F4DFE8B340D81183C208F70F9D2D797908754D
+
+// SillyQL script scheduling, see CommandScheduler.h
+
+#include "CommandScheduler.h"
+
+#include <algorithm>
+#include <utility>
+
+CommandScheduler::CommandScheduler(std::ostream& os_in, size_t num_threads) : os{os_in} {
+  if (num_threads == 0)
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  workers.reserve(num_threads);
+  for (size_t i = 0; i < num_threads; ++i)
+    workers.emplace_back(&CommandScheduler::worker, this);
+}
+
+CommandScheduler::~CommandScheduler() {
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    wait_written(lock);
+    stopping = true;
+  }
+  work_ready.notify_all();
+  for (std::thread& t : workers)
+    t.join();
+}
+
+void CommandScheduler::submit(const std::vector<std::string>& reads,
+                              const std::vector<std::string>& writes, bool barrier, Command run) {
+  std::unique_lock<std::mutex> lock(mutex);
+  progress.wait(lock, [&] { return failure || (jobs.size() < MAX_IN_FLIGHT && held_bytes < MAX_HELD_BYTES); });
+  if (failure)
+    std::rethrow_exception(failure);
+
+  size_t pos = first_job + jobs.size();
+  jobs.push_back(std::make_unique<Job>(*this, pos));
+  jobs.back()->run = std::move(run);
+
+  if (barrier) {
+    for (size_t p = first_job; p < pos; ++p)
+      depend_on(pos, p);
+    // everything later waits on the barrier, which already waits on all of these
+    tables.clear();
+    last_barrier = pos;
+  } else {
+    depend_on(pos, last_barrier);
+    for (const std::string& name : reads) {
+      TableUse& use = tables[name];
+      depend_on(pos, use.last_writer);
+      // a long run of reads would otherwise keep every one of them around
+      if (use.readers.size() >= 64) {
+        use.readers.erase(std::remove_if(use.readers.begin(), use.readers.end(),
+                                         [&](size_t r) { Job* j = job_at(r); return !j || j->done; }),
+                          use.readers.end());
+      }
+      use.readers.push_back(pos);
+    }
+    for (const std::string& name : writes) {
+      TableUse& use = tables[name];
+      depend_on(pos, use.last_writer);
+      for (size_t r : use.readers)
+        depend_on(pos, r);
+      use.readers.clear();
+      use.last_writer = pos;
+    }
+  }
+
+  if (jobs.back()->waiting_on == 0) {
+    ready.push_back(pos);
+    work_ready.notify_one();
+  }
+}
+
+void CommandScheduler::drain() {
+  std::unique_lock<std::mutex> lock(mutex);
+  wait_written(lock);
+  os.flush();
+  if (failure)
+    std::rethrow_exception(failure);
+}
+
+// until every job is written, or one failed and nothing more will be
+void CommandScheduler::wait_written(std::unique_lock<std::mutex>& lock) {
+  progress.wait(lock, [&] { return jobs.empty() || failure; });
+}
+
+// caller holds mutex; pos is the job being submitted
+void CommandScheduler::depend_on(size_t pos, size_t on) {
+  if (on == NONE || on == pos)
+    return;
+  Job* dep = job_at(on);
+  if (!dep || dep->done)
+    return;
+  dep->dependents.push_back(pos);
+  ++job_at(pos)->waiting_on;
+}
+
+void CommandScheduler::worker() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    work_ready.wait(lock, [&] { return stopping || failure || !ready.empty(); });
+    // after a failure nothing else starts, as nothing after it would have run on its own
+    if (failure || ready.empty())
+      return;
+    size_t pos = ready.front();
+    ready.pop_front();
+    Job* job = job_at(pos);
+
+    lock.unlock();
+    job->output.start();
+    try {
+      job->run(job->out);
+    } catch (...) {
+      job->error = std::current_exception();
+    }
+    job->output.finish();
+    lock.lock();
+
+    job->done = true;
+    for (size_t d : job->dependents) {
+      if (--job_at(d)->waiting_on == 0) {
+        ready.push_back(d);
+        work_ready.notify_one();
+      }
+    }
+    write_finished();
+  }
+}
+
+// caller holds mutex: writes out every finished job at the front, in script order.
+// A command that threw fails the script right where it would have run on its own.
+void CommandScheduler::write_finished() {
+  bool wrote = false;
+  while (!failure && !jobs.empty() && jobs.front()->done) {
+    std::string& held = jobs.front()->output.held;
+    os.write(held.data(), static_cast<std::streamsize>(held.size()));
+    held_bytes -= held.size();
+    if (jobs.front()->error) {
+      // submit() or drain() hands it to the script's thread; workers stop taking jobs
+      failure = jobs.front()->error;
+      work_ready.notify_all();
+      wrote = true;
+      break;
+    }
+    jobs.pop_front();
+    ++first_job;
+    wrote = true;
+  }
+  if (wrote) {
+    os.flush();
+    progress.notify_all();
+  }
+}
+
+void CommandScheduler::JobOutput::start() {
+  chunk = std::make_unique<char[]>(CHUNK_BYTES);
+  setp(chunk.get(), chunk.get() + CHUNK_BYTES);
+}
+
+void CommandScheduler::JobOutput::finish() {
+  flush_chunk();
+  setp(nullptr, nullptr);
+  chunk.reset();
+}
+
+CommandScheduler::JobOutput::int_type CommandScheduler::JobOutput::overflow(int_type ch) {
+  flush_chunk();
+  if (traits_type::eq_int_type(ch, traits_type::eof()))
+    return traits_type::not_eof(ch);
+  *pptr() = traits_type::to_char_type(ch);
+  pbump(1);
+  return ch;
+}
+
+int CommandScheduler::JobOutput::sync() {
+  flush_chunk();
+  return 0;
+}
+
+void CommandScheduler::JobOutput::flush_chunk() {
+  size_t n = static_cast<size_t>(pptr() - pbase());
+  if (!direct) {
+    std::lock_guard<std::mutex> guard(owner.mutex);
+    if (owner.first_job != pos) {
+      held.append(pbase(), n);
+      owner.held_bytes += n;
+      setp(chunk.get(), chunk.get() + CHUNK_BYTES);
+      return;
+    }
+    // everything before this job is written, and nothing after it writes until it's done,
+    // so from here on it has os to itself
+    direct = true;
+    owner.held_bytes -= held.size();
+    owner.progress.notify_all();
+  }
+  if (!held.empty()) {
+    owner.os.write(held.data(), static_cast<std::streamsize>(held.size()));
+    std::string().swap(held);
+  }
+  owner.os.write(pbase(), static_cast<std::streamsize>(n));
+  setp(chunk.get(), chunk.get() + CHUNK_BYTES);
+}
@@ -0,0 +1,121 @@
+// Project Identifier: C0F4DFE8B340D81183C208F70F9D2D797908754D
+
+// SillyQL script scheduling: commands are read ahead of execution and each
+// one only waits for the earlier commands it conflicts with (one of them
+// writes a table the other reads or writes), so work on unrelated tables runs
+// on several threads at once. Output still comes out in script order: the
+// command at the head of the script writes straight through, and only ones
+// running ahead of it hold their output until everything before is written.
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+
+class CommandScheduler {
+  public:
+  // runs one command, writing everything it prints to the stream it's handed
+  using Command = std::function<void(std::ostream&)>;
+
+  // output goes to os; num_threads 0 means one per hardware thread
+  explicit CommandScheduler(std::ostream& os, size_t num_threads = 0);
+  CommandScheduler(const CommandScheduler&) = delete;
+  CommandScheduler& operator=(const CommandScheduler&) = delete;
+  ~CommandScheduler(); // drains, but leaves a failure for drain() to rethrow
+
+  // queues a command that reads the tables in reads and changes the ones in
+  // writes. A barrier waits for everything before it and everything after
+  // waits for it. Blocks while too many commands, or too many bytes of their
+  // output, are still unwritten.
+  //
+  // A command that throws fails the script at its place: the output before it
+  // and its own is written, nothing after it is, no command not yet started
+  // runs, and the exception is rethrown here on the caller's thread, by
+  // submit() or drain(), whichever comes next.
+  void submit(const std::vector<std::string>& reads, const std::vector<std::string>& writes,
+              bool barrier, Command run);
+  // returns once every submitted command has run and its output is written
+  void drain();
+
+  private:
+  static constexpr size_t MAX_IN_FLIGHT = 1024;
+  static constexpr size_t MAX_HELD_BYTES = 16 << 20;
+  static constexpr size_t CHUNK_BYTES = 16 << 10;
+  static constexpr size_t NONE = SIZE_MAX;
+
+  // one job's output, a chunk at a time: straight to os once the job is at the
+  // head of the script, into held until then
+  class JobOutput : public std::streambuf {
+    public:
+    JobOutput(CommandScheduler& owner_in, size_t pos_in) : owner{owner_in}, pos{pos_in} {}
+    // the worker running the job calls these around it
+    void start();
+    void finish();
+
+    std::string held; // guarded by mutex until direct
+
+    protected:
+    int_type overflow(int_type ch) override;
+    int sync() override;
+
+    private:
+    CommandScheduler& owner;
+    size_t pos;
+    bool direct = false; // only the job's own worker looks at it
+    std::unique_ptr<char[]> chunk;
+
+    void flush_chunk();
+  };
+
+  struct Job {
+    Job(CommandScheduler& owner, size_t pos) : output{owner, pos}, out{&output} {}
+    Command run;
+    JobOutput output;                // whatever write_finished() still has to write is in output.held
+    std::ostream out;
+    size_t waiting_on = 0;           // unfinished commands this one depends on
+    std::vector<size_t> dependents;  // script positions waiting on this one
+    bool done = false;
+    std::exception_ptr error;        // becomes failure once everything before it is written
+  };
+  // the commands that touched one table since its last writer
+  struct TableUse {
+    size_t last_writer = NONE;
+    std::vector<size_t> readers;
+  };
+
+  std::ostream& os;
+  std::mutex mutex;
+  std::condition_variable work_ready;
+  std::condition_variable progress;
+  std::deque<std::unique_ptr<Job>> jobs; // jobs[i] is script position first_job + i
+  size_t first_job = 0;
+  std::deque<size_t> ready;
+  std::unordered_map<std::string, TableUse> tables;
+  size_t last_barrier = NONE;
+  size_t held_bytes = 0; // in every job's output.held
+  bool stopping = false;
+  std::exception_ptr failure;      // the first command that threw, in script order
+  std::vector<std::thread> workers;
+
+  // nullptr once the job's output has been written
+  Job* job_at(size_t pos) noexcept {
+    return pos < first_job ? nullptr : jobs[pos - first_job].get();
+  }
+  void depend_on(size_t pos, size_t on);
+  void worker();
+  void write_finished();
+  void wait_written(std::unique_lock<std::mutex>& lock);
+};
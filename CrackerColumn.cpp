@@ -0,0 +1,77 @@
+// Project Identifier: C0F4DFE8B340D81183C208F70F9D2D797908754D
+
+// SillyQL adaptive indexing, see CrackerColumn.h
+
+#include "CrackerColumn.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+
+void CrackerColumn::reset(const RowStore& table2D, size_t col, EntryType type, size_t rows) {
+  clear();
+  entries.reserve(rows);
+  for (size_t r = 0; r < rows; ++r) {
+    const TableEntry& cell = table2D[r][col];
+    double value = 0;
+    switch (type) {
+      case EntryType::String:
+        return;
+      case EntryType::Double:
+        value = cell.as<double>();
+        break;
+      case EntryType::Int:
+        value = cell.as<int>();
+        break;
+      case EntryType::Bool:
+        value = cell.as<bool>() ? 1 : 0;
+        break;
+    }
+    if (std::isnan(value))
+      nan_rows.push_back(r);
+    else
+      entries.push_back(Entry{value, r});
+  }
+  num_rows = rows;
+}
+
+void CrackerColumn::clear() noexcept {
+  entries.clear();
+  nan_rows.clear();
+  cuts.clear();
+  num_rows = 0;
+}
+
+void CrackerColumn::select(const std::optional<Bound>& from, const std::optional<Bound>& to,
+                           std::vector<size_t>& rows) {
+  if (from && to)
+    rows.insert(rows.end(), nan_rows.begin(), nan_rows.end());
+  if (from && to && std::make_pair(to->value, to->inclusive) < std::make_pair(from->value, from->inclusive))
+    return;
+  size_t first = from ? crack(*from) : 0;
+  size_t last = to ? crack(*to) : entries.size();
+  for (size_t i = first; i < last; ++i)
+    rows.push_back(entries[i].row);
+}
+
+size_t CrackerColumn::used_bytes() const noexcept {
+  // map nodes are libstdc++'s: rb-tree header then the pair
+  return entries.capacity() * sizeof(Entry) + nan_rows.capacity() * sizeof(size_t) + cuts.size() * (32 + sizeof(std::pair<double, bool>) + sizeof(size_t));
+}
+
+size_t CrackerColumn::crack(const Bound& bound) {
+  std::pair<double, bool> key{bound.value, bound.inclusive};
+  auto next = cuts.lower_bound(key);
+  if (next != cuts.end() && next->first == key)
+    return next->second;
+
+  // the piece between the neighbouring cuts is the only one holding values on both sides
+  size_t lo = (next == cuts.begin()) ? 0 : std::prev(next)->second;
+  size_t hi = (next == cuts.end()) ? entries.size() : next->second;
+  auto left_of = [&](const Entry& e) { return bound.inclusive ? e.value <= bound.value : e.value < bound.value; };
+  auto mid = std::partition(entries.begin() + static_cast<std::ptrdiff_t>(lo),
+                            entries.begin() + static_cast<std::ptrdiff_t>(hi), left_of);
+  size_t pos = static_cast<size_t>(mid - entries.begin());
+  cuts.emplace_hint(next, key, pos);
+  return pos;
+}
@@ -0,0 +1,61 @@
+// Project Identifier: C0F4DFE8B340D81183C208F70F9D2D797908754D
+
+// SillyQL adaptive indexing (database cracking): a copy of one numeric
+// column, as (value, row) pairs, that range queries reorganize as they go.
+// A query only partitions the piece its bound falls in around that bound and
+// remembers where the cut landed, so the copy gets more sorted wherever
+// queries look. The first range costs about a scan; repeating one is a map
+// lookup plus copying out the rows it matches.
+//
+// Ints, doubles and bools all compare exactly as doubles. NaNs can't be
+// ordered, so they are kept aside: no < or > passes them, but BETWEEN's test,
+// !(v < lo) && !(hi < v), does.
+
+#pragma once
+
+#include <cstddef>
+#include <map>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "RowStore.h"
+
+
+class CrackerColumn {
+  public:
+  // one side of a range: with inclusive the values <= value are left of it,
+  // otherwise the values < value
+  struct Bound {
+    double value;
+    bool inclusive;
+  };
+
+  // rows [0, covered()) of the column are in the copy
+  size_t covered() const noexcept { return num_rows; }
+  // copies rows [0, rows) of col, forgetting every cut
+  void reset(const RowStore& table2D, size_t col, EntryType type, size_t rows);
+  void clear() noexcept;
+  // appends the rows right of from and left of to, in no particular order;
+  // a missing bound doesn't limit that side, neither bound may be NaN. With
+  // both bounds (BETWEEN) the NaN rows come too
+  void select(const std::optional<Bound>& from, const std::optional<Bound>& to, std::vector<size_t>& rows);
+
+  size_t used_bytes() const noexcept;
+
+  private:
+  struct Entry {
+    double value;
+    size_t row;
+  };
+
+  std::vector<Entry> entries;
+  std::vector<size_t> nan_rows;
+  size_t num_rows = 0;
+  // cut -> first position right of it; (v, false) sorts before (v, true)
+  std::map<std::pair<double, bool>, size_t> cuts;
+
+  // where bound cuts the copy, partitioning the piece it falls in if no
+  // query has cut there before
+  size_t crack(const Bound& bound);
+};
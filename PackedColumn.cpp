@@ -0,0 +1,132 @@
+// Project Identifier: C0F4DFE8B340D81183C208F70F9D2D797908754D
+
+// SillyQL packed columns, see PackedColumn.h
+
+#include "PackedColumn.h"
+
+#include <algorithm>
+
+// bits needed to tell apart every number in [0, range]
+static unsigned bits_for(uint64_t range) {
+  unsigned bits = 0;
+  while (bits < 64 && (range >> bits) != 0)
+    ++bits;
+  return bits;
+}
+
+// runs of equal values, each ending at the index past it; NaN never equals
+// itself, so every NaN is a run of its own, which select() still tests right
+template <typename T>
+static void find_runs(const std::vector<T>& values, std::vector<double>& run_values, std::vector<uint32_t>& run_ends) {
+  for (size_t i = 0; i < values.size(); ++i) {
+    if (i == 0 || !(values[i] == values[i - 1])) {
+      run_values.push_back(static_cast<double>(values[i]));
+      run_ends.push_back(0);
+    }
+    run_ends.back() = static_cast<uint32_t>(i + 1);
+  }
+}
+
+static size_t run_bytes(size_t runs) {
+  return runs * (sizeof(double) + sizeof(uint32_t));
+}
+
+static size_t packed_bytes(size_t fields, unsigned width) {
+  return (fields * width + 63) / 64 * sizeof(uint64_t);
+}
+
+void PackedColumn::pack_fields(const std::vector<uint64_t>& fields) {
+  words.assign(packed_bytes(fields.size(), width) / sizeof(uint64_t), 0);
+  if (width == 0)
+    return;
+  for (size_t i = 0; i < fields.size(); ++i) {
+    size_t bit = i * width;
+    size_t shift = bit & 63;
+    words[bit >> 6] |= fields[i] << shift;
+    if (shift + width > 64)
+      words[(bit >> 6) + 1] |= fields[i] >> (64 - shift);
+  }
+}
+
+PackedColumn PackedColumn::pack_ints(const std::vector<int64_t>& values) {
+  PackedColumn packed;
+  packed.count = values.size();
+  if (values.empty()) {
+    packed.kind = Encoding::BITPACK;
+    return packed;
+  }
+
+  auto [lo, hi] = std::minmax_element(values.begin(), values.end());
+  unsigned value_width = bits_for(static_cast<uint64_t>(*hi - *lo));
+  int64_t step_lo = 0, step_hi = 0;
+  for (size_t i = 1; i < values.size(); ++i) {
+    int64_t step = values[i] - values[i - 1];
+    step_lo = (i == 1) ? step : std::min(step_lo, step);
+    step_hi = (i == 1) ? step : std::max(step_hi, step);
+  }
+  unsigned step_width = bits_for(static_cast<uint64_t>(step_hi - step_lo));
+  std::vector<double> run_values;
+  std::vector<uint32_t> run_ends;
+  find_runs(values, run_values, run_ends);
+
+  size_t bitpack_size = packed_bytes(values.size(), value_width);
+  size_t delta_size = packed_bytes(values.size() - 1, step_width);
+  size_t runs_size = run_bytes(run_values.size());
+  if (runs_size < std::min(bitpack_size, delta_size)) {
+    packed.kind = Encoding::RUNS;
+    packed.values = std::move(run_values);
+    packed.run_ends = std::move(run_ends);
+    return packed;
+  }
+
+  std::vector<uint64_t> fields;
+  if (delta_size < bitpack_size) {
+    packed.kind = Encoding::DELTA;
+    packed.first = values[0];
+    packed.base = step_lo;
+    packed.width = step_width;
+    for (size_t i = 1; i < values.size(); ++i)
+      fields.push_back(static_cast<uint64_t>(values[i] - values[i - 1] - step_lo));
+  } else {
+    packed.kind = Encoding::BITPACK;
+    packed.base = *lo;
+    packed.width = value_width;
+    for (int64_t value : values)
+      fields.push_back(static_cast<uint64_t>(value - *lo));
+  }
+  packed.pack_fields(fields);
+  return packed;
+}
+
+PackedColumn PackedColumn::pack_doubles(const std::vector<double>& values) {
+  PackedColumn packed;
+  packed.count = values.size();
+  std::vector<double> run_values;
+  std::vector<uint32_t> run_ends;
+  find_runs(values, run_values, run_ends);
+  if (run_bytes(run_values.size()) < values.size() * sizeof(double)) {
+    packed.kind = Encoding::RUNS;
+    packed.values = std::move(run_values);
+    packed.run_ends = std::move(run_ends);
+  } else {
+    packed.kind = Encoding::PLAIN;
+    packed.values = values;
+  }
+  return packed;
+}
+
+PackedColumn PackedColumn::pack_bools(const std::vector<bool>& values) {
+  PackedColumn packed;
+  packed.kind = Encoding::BITSET;
+  packed.count = values.size();
+  packed.words.assign((values.size() + 63) / 64, 0);
+  for (size_t i = 0; i < values.size(); ++i)
+    if (values[i])
+      packed.words[i / 64] |= uint64_t{1} << (i % 64);
+  return packed;
+}
+
+size_t PackedColumn::used_bytes() const noexcept {
+  return sizeof(PackedColumn) + words.capacity() * sizeof(uint64_t) +
+         values.capacity() * sizeof(double) + run_ends.capacity() * sizeof(uint32_t);
+}
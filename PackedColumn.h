@@ -0,0 +1,126 @@
+// Project Identifier: C0F4DFE8B340D81183C208F70F9D2D797908754D
+
+// SillyQL packed scan copies: one int, double or bool column of one full
+// slab, copied out and laid out contiguously so a scan can test it without
+// striding over whole rows. This is a scan speed feature, not compression:
+// the slab keeps every cell as a TableEntry, so a copy is memory on top of
+// the rows, like an index. Each slab picks whichever encoding keeps its own
+// copy smallest:
+//
+//   BITPACK  ints as value - min in just enough bits for max - min
+//   DELTA    ints as the first value, then each step from the previous one
+//            bit packed the same way; IDs that climb steadily take a bit or two
+//   RUNS     (value, end) per run of equal values, for ints or doubles
+//   BITSET   bools, one bit each
+//   PLAIN    doubles that don't run, back to back
+//
+// select() tests values where they sit: a bit packed value is a shift, a mask
+// and an add, a run or a bitset's two possible values are tested once, and
+// nothing is ever decoded into a buffer. Ints, doubles and bools all come out
+// exactly as doubles, the same way CrackerColumn sees them.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+class PackedColumn {
+  public:
+  enum class Encoding : uint8_t { BITPACK, DELTA, RUNS, BITSET, PLAIN };
+
+  static PackedColumn pack_ints(const std::vector<int64_t>& values);
+  static PackedColumn pack_doubles(const std::vector<double>& values);
+  static PackedColumn pack_bools(const std::vector<bool>& values);
+
+  Encoding encoding() const noexcept { return kind; }
+  size_t size() const noexcept { return count; }
+  size_t used_bytes() const noexcept;
+
+  // calls emit(i) for every value i, in order, that pass(value) holds for
+  template <typename Pass, typename Emit>
+  void select(const Pass& pass, const Emit& emit) const;
+
+  private:
+  Encoding kind = Encoding::PLAIN;
+  size_t count = 0;
+  int64_t base = 0;              // BITPACK: min; DELTA: smallest step
+  int64_t first = 0;             // DELTA: value 0
+  unsigned width = 0;            // BITPACK, DELTA: bits per value
+  std::vector<uint64_t> words;   // BITPACK, DELTA, BITSET
+  std::vector<double> values;    // RUNS: one per run; PLAIN: all of them
+  std::vector<uint32_t> run_ends;
+
+  // field i of the bit packed words
+  uint64_t field(size_t i) const noexcept {
+    size_t bit = i * width;
+    size_t shift = bit & 63;
+    uint64_t v = words[bit >> 6] >> shift;
+    if (shift + width > 64)
+      v |= words[(bit >> 6) + 1] << (64 - shift);
+    return v & ((uint64_t{1} << width) - 1);
+  }
+  void pack_fields(const std::vector<uint64_t>& fields);
+};
+
+
+template <typename Pass, typename Emit>
+void PackedColumn::select(const Pass& pass, const Emit& emit) const {
+  switch (kind) {
+    case Encoding::BITPACK:
+      if (width == 0) {
+        // every value is base
+        if (pass(static_cast<double>(base)))
+          for (size_t i = 0; i < count; ++i)
+            emit(i);
+        return;
+      }
+      for (size_t i = 0; i < count; ++i)
+        if (pass(static_cast<double>(base + static_cast<int64_t>(field(i)))))
+          emit(i);
+      return;
+    case Encoding::DELTA: {
+      int64_t value = first;
+      if (count > 0 && pass(static_cast<double>(value)))
+        emit(0);
+      for (size_t i = 1; i < count; ++i) {
+        value += base + static_cast<int64_t>(width == 0 ? 0 : field(i - 1));
+        if (pass(static_cast<double>(value)))
+          emit(i);
+      }
+      return;
+    }
+    case Encoding::RUNS: {
+      size_t start = 0;
+      for (size_t run = 0; run < values.size(); ++run) {
+        if (pass(values[run]))
+          for (size_t i = start; i < run_ends[run]; ++i)
+            emit(i);
+        start = run_ends[run];
+      }
+      return;
+    }
+    case Encoding::BITSET: {
+      bool pass_false = pass(0.0);
+      bool pass_true = pass(1.0);
+      if (!pass_false && !pass_true)
+        return;
+      for (size_t w = 0; w < words.size(); ++w) {
+        uint64_t hits = (pass_true ? words[w] : 0) | (pass_false ? ~words[w] : 0);
+        if (w == words.size() - 1 && count % 64 != 0)
+          hits &= (uint64_t{1} << (count % 64)) - 1;
+        while (hits) {
+          emit(w * 64 + static_cast<size_t>(__builtin_ctzll(hits)));
+          hits &= hits - 1;
+        }
+      }
+      return;
+    }
+    case Encoding::PLAIN:
+      for (size_t i = 0; i < count; ++i)
+        if (pass(values[i]))
+          emit(i);
+      return;
+  }
+}
@@ -0,0 +1,98 @@
+// Project Identifier: C0F4DFE8B340D81183C208F70F9D2D797908754D
+
+// SillyQL join hash table, see ProbeTable.h
+
+#include "ProbeTable.h"
+
+#include <functional>
+
+void ProbeTable::add(const TableEntry& key, size_t row) {
+  if (2 * (keys.size() + 1) > slots.size())
+    grow();
+  uint64_t hash = std::hash<TableEntry>{}(key);
+  size_t s = hash & mask();
+  while (slots[s].key != EMPTY && !(slots[s].hash == hash && keys[slots[s].key] == key))
+    s = (s + 1) & mask();
+  if (slots[s].key == EMPTY) {
+    slots[s] = Slot{hash, keys.size()};
+    keys.push_back(key);
+  }
+  added.emplace_back(slots[s].key, row);
+}
+
+void ProbeTable::finish() {
+  // counting sort by key; stable, so each key's rows stay in the order they came
+  offsets.assign(keys.size() + 1, 0);
+  for (const auto& [key, row] : added)
+    ++offsets[key + 1];
+  for (size_t k = 0; k < keys.size(); ++k)
+    offsets[k + 1] += offsets[k];
+  rows.resize(added.size());
+  std::vector<size_t> next(offsets.begin(), offsets.end() - 1);
+  for (const auto& [key, row] : added)
+    rows[next[key]++] = row;
+  added.clear();
+  added.shrink_to_fit();
+}
+
+void ProbeTable::probe(const TableEntry* const* probes, size_t n, Match* out) const {
+  if (keys.empty()) {
+    for (size_t i = 0; i < n; ++i)
+      out[i] = Match{};
+    return;
+  }
+  // hash everything and start loading the slots
+  uint64_t hashes[BATCH];
+  size_t first[BATCH];
+  for (size_t i = 0; i < n; ++i) {
+    hashes[i] = std::hash<TableEntry>{}(*probes[i]);
+    first[i] = hashes[i] & mask();
+    __builtin_prefetch(&slots[first[i]]);
+  }
+  // the first slot whose hash matches is the key nearly every time; start
+  // loading it and where its rows are
+  size_t found[BATCH];
+  for (size_t i = 0; i < n; ++i) {
+    found[i] = EMPTY;
+    for (size_t s = first[i]; slots[s].key != EMPTY; s = (s + 1) & mask()) {
+      if (slots[s].hash == hashes[i]) {
+        found[i] = s;
+        __builtin_prefetch(&keys[slots[s].key]);
+        __builtin_prefetch(&offsets[slots[s].key]);
+        break;
+      }
+    }
+  }
+  // compare keys, and start loading the rows of the ones that matched
+  for (size_t i = 0; i < n; ++i) {
+    size_t key = (found[i] == EMPTY) ? EMPTY : find_from(found[i], hashes[i], *probes[i]);
+    if (key == EMPTY) {
+      out[i] = Match{};
+      continue;
+    }
+    out[i] = Match{rows.data() + offsets[key], rows.data() + offsets[key + 1]};
+    __builtin_prefetch(out[i].begin);
+  }
+}
+
+size_t ProbeTable::find_from(size_t s, uint64_t hash, const TableEntry& value) const noexcept {
+  for (; slots[s].key != EMPTY; s = (s + 1) & mask()) {
+    if (slots[s].hash == hash && keys[slots[s].key] == value)
+      return slots[s].key;
+  }
+  return EMPTY;
+}
+
+void ProbeTable::grow() {
+  std::vector<Slot> old;
+  old.swap(slots);
+  slots.resize(old.empty() ? 16 : 2 * old.size());
+  for (const Slot& slot : old) {
+    if (slot.key == EMPTY)
+      continue;
+    size_t s = slot.hash & mask();
+    while (slots[s].key != EMPTY)
+      s = (s + 1) & mask();
+    slots[s] = slot;
+  }
+}
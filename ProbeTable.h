@@ -0,0 +1,66 @@
+// Project Identifier: C0F4DFE8B340D81183C208F70F9D2D797908754D
+
+// SillyQL join hash table: the rows of one side of a JOIN grouped by key,
+// built once and then probed with a batch of keys at a time.
+//
+// A key at a time lookup waits out a cache miss on the slot, then one on the
+// key it compares against, then one on the rows, and none of them can start
+// before the one before it is done. probe() takes up to BATCH keys and runs
+// each step for the whole batch before the next, prefetching as it goes, so
+// the misses of different keys overlap instead of adding up.
+//
+// Slots are open addressed (linear probing, at most half full) and hold the
+// full 64 bit hash next to the key's index, so a probe only looks at a key
+// whose hash matched. Rows are kept per key in one flat array, in the order
+// they were added.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "TableEntry.h"
+
+
+class ProbeTable {
+  public:
+  static constexpr size_t BATCH = 16;
+
+  // the rows added under one key, [begin, end); empty if none were
+  struct Match {
+    const size_t* begin = nullptr;
+    const size_t* end = nullptr;
+    size_t size() const noexcept { return static_cast<size_t>(end - begin); }
+  };
+
+  // building: every add() before finish(), every probe() after it
+  void add(const TableEntry& key, size_t row);
+  void finish();
+
+  size_t num_keys() const noexcept { return keys.size(); }
+  const TableEntry& key(size_t k) const noexcept { return keys[k]; }
+
+  // out[i] is the match for *probes[i], i < n <= BATCH
+  void probe(const TableEntry* const* probes, size_t n, Match* out) const;
+
+  private:
+  static constexpr size_t EMPTY = SIZE_MAX;
+
+  struct Slot {
+    uint64_t hash = 0;
+    size_t key = EMPTY;
+  };
+
+  std::vector<Slot> slots;    // a power of two of them
+  std::vector<TableEntry> keys;
+  std::vector<size_t> offsets; // rows of key k are rows[offsets[k], offsets[k + 1])
+  std::vector<size_t> rows;
+  std::vector<std::pair<size_t, size_t>> added; // (key, row) until finish()
+
+  size_t mask() const noexcept { return slots.size() - 1; }
+  // the key at or after slot s with this hash and value, or EMPTY
+  size_t find_from(size_t s, uint64_t hash, const TableEntry& value) const noexcept;
+  void grow();
+};
@@ -0,0 +1,108 @@
+// Project Identifier: C0F4DFE8B340D81183C208F70F9D2D797908754D
+
+// SillyQL query result cache, see ResultCache.h
+
+#include "ResultCache.h"
+
+#include <utility>
+
+ResultCache::ResultCache(size_t capacity_bytes) : capacity{capacity_bytes} {}
+
+ResultCache::Bytes ResultCache::find(const std::string& key, uint64_t at_version) {
+  std::lock_guard<std::mutex> guard(mutex);
+  if (!catch_up(at_version))
+    return nullptr;
+  auto it = entries.find(key);
+  if (it == entries.end())
+    return nullptr;
+  lru.splice(lru.begin(), lru, it->second);
+  return it->second->bytes;
+}
+
+void ResultCache::insert(const std::string& key, uint64_t at_version, std::string bytes) {
+  size_t size = key.size() + bytes.size();
+  if (size > max_entry_bytes())
+    return;
+  std::lock_guard<std::mutex> guard(mutex);
+  if (!catch_up(at_version))
+    return;
+  auto it = entries.find(key);
+  if (it != entries.end()) {
+    // another reader got here first with the same result
+    lru.splice(lru.begin(), lru, it->second);
+    return;
+  }
+  lru.push_front(Entry{key, std::make_shared<const std::string>(std::move(bytes))});
+  entries.emplace(key, lru.begin());
+  used += size;
+  while (used > capacity) {
+    const Entry& victim = lru.back();
+    used -= victim.key.size() + victim.bytes->size();
+    entries.erase(victim.key);
+    lru.pop_back();
+  }
+}
+
+void ResultCache::clear() {
+  std::lock_guard<std::mutex> guard(mutex);
+  drop_all();
+}
+
+bool ResultCache::catch_up(uint64_t at_version) {
+  if (at_version < version)
+    return false;
+  if (at_version > version) {
+    drop_all();
+    version = at_version;
+  }
+  return true;
+}
+
+void ResultCache::drop_all() {
+  entries.clear();
+  lru.clear();
+  used = 0;
+}
+
+CaptureBuf::CaptureBuf(std::streambuf* target_in, size_t limit_in) : target{target_in}, limit{limit_in} {
+  setp(out_buf, out_buf + BUF_SIZE);
+}
+
+CaptureBuf::~CaptureBuf() {
+  flush_out();
+}
+
+std::string CaptureBuf::take() {
+  flush_out();
+  return std::move(copy);
+}
+
+CaptureBuf::int_type CaptureBuf::overflow(int_type ch) {
+  if (!flush_out())
+    return traits_type::eof();
+  if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+    *pptr() = traits_type::to_char_type(ch);
+    pbump(1);
+  }
+  return traits_type::not_eof(ch);
+}
+
+// hands the bytes on without syncing the target, which flushes on its own schedule
+int CaptureBuf::sync() {
+  return flush_out() ? 0 : -1;
+}
+
+bool CaptureBuf::flush_out() {
+  size_t len = static_cast<size_t>(pptr() - pbase());
+  if (!truncated) {
+    if (copy.size() + len > limit) {
+      truncated = true;
+      std::string().swap(copy);
+    } else {
+      copy.append(pbase(), len);
+    }
+  }
+  bool ok = static_cast<size_t>(target->sputn(pbase(), static_cast<std::streamsize>(len))) == len;
+  setp(out_buf, out_buf + BUF_SIZE);
+  return ok;
+}
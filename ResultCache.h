@@ -0,0 +1,81 @@
+// Project Identifier: C0F4DFE8B340D81183C208F70F9D2D797908754D
+
+// SillyQL query result cache: formatted output bytes by normalized query,
+// valid for one table version. A reader whose snapshot is newer than what the
+// cache holds drops everything; one with an older snapshot goes around it.
+// Least recently used entries go once the byte cap is reached. Readers share
+// it without any table latch, so it locks internally.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <unordered_map>
+
+
+class ResultCache {
+  public:
+  using Bytes = std::shared_ptr<const std::string>;
+
+  explicit ResultCache(size_t capacity_bytes);
+
+  // the bytes cached for key as of version, or null
+  Bytes find(const std::string& key, uint64_t version);
+  // remembers bytes for key as of version; ignored if that version is stale
+  // or the bytes would take more than a quarter of the cache
+  void insert(const std::string& key, uint64_t version, std::string bytes);
+  void clear();
+
+  // largest result worth capturing
+  size_t max_entry_bytes() const noexcept { return capacity / 4; }
+
+  private:
+  struct Entry {
+    std::string key;
+    Bytes bytes;
+  };
+
+  const size_t capacity;
+  std::mutex mutex;
+  uint64_t version = 0;
+  size_t used = 0; // key and result bytes of every entry
+  std::list<Entry> lru; // most recently used first
+  std::unordered_map<std::string, std::list<Entry>::iterator> entries;
+
+  // moves the cache up to version; false if version is older than the cache
+  bool catch_up(uint64_t version);
+  void drop_all();
+};
+
+// passes everything through to another streambuf and keeps a copy of up to
+// limit bytes; past that it stops copying and complete() turns false
+class CaptureBuf : public std::streambuf {
+  public:
+  CaptureBuf(std::streambuf* target, size_t limit);
+  CaptureBuf(const CaptureBuf&) = delete;
+  CaptureBuf& operator=(const CaptureBuf&) = delete;
+  ~CaptureBuf() override;
+
+  bool complete() const noexcept { return !truncated; }
+  // the copy, once everything has been written
+  std::string take();
+
+  protected:
+  int_type overflow(int_type ch) override;
+  int sync() override;
+
+  private:
+  static constexpr size_t BUF_SIZE = 4096;
+  std::streambuf* target;
+  size_t limit;
+  std::string copy;
+  bool truncated = false;
+  char out_buf[BUF_SIZE];
+
+  bool flush_out();
+};
@@ -0,0 +1,96 @@
+// Project Identifier: C0F4DFE8B340D81183C208F70F9D2D797908754D
+
+// SillyQL bitmap index postings, see RowBitmap.h
+
+#include "RowBitmap.h"
+
+#include <algorithm>
+
+void RowBitmap::push_back(size_t row) {
+  size_t key = row >> CHUNK_BITS;
+  uint16_t low = static_cast<uint16_t>(row & ((size_t{1} << CHUNK_BITS) - 1));
+  if (chunks.empty() || chunks.back().key != key)
+    chunks.push_back(Chunk{key, {}, {}, 0});
+
+  Chunk& chunk = chunks.back();
+  if (chunk.bits.empty()) {
+    chunk.array.push_back(low);
+    if (chunk.array.size() > ARRAY_MAX) {
+      chunk.bits.assign(BITSET_WORDS, 0);
+      for (uint16_t v : chunk.array)
+        chunk.bits[v >> 6] |= uint64_t{1} << (v & 63);
+      std::vector<uint16_t>().swap(chunk.array);
+    }
+  } else {
+    chunk.bits[low >> 6] |= uint64_t{1} << (low & 63);
+  }
+  ++chunk.count;
+  ++cardinality;
+}
+
+size_t RowBitmap::rank(size_t limit) const noexcept {
+  size_t limit_key = limit >> CHUNK_BITS;
+  size_t limit_low = limit & ((size_t{1} << CHUNK_BITS) - 1);
+  size_t below = 0;
+  for (const Chunk& chunk : chunks) {
+    if (chunk.key < limit_key) {
+      below += chunk.count;
+      continue;
+    }
+    if (chunk.key > limit_key)
+      break;
+    if (chunk.bits.empty()) {
+      below += static_cast<size_t>(std::lower_bound(chunk.array.begin(), chunk.array.end(), limit_low) -
+                                   chunk.array.begin());
+    } else {
+      size_t words = limit_low >> 6;
+      for (size_t w = 0; w < words; ++w)
+        below += static_cast<size_t>(__builtin_popcountll(chunk.bits[w]));
+      if (limit_low & 63)
+        below += static_cast<size_t>(
+            __builtin_popcountll(chunk.bits[words] & ((uint64_t{1} << (limit_low & 63)) - 1)));
+    }
+    break;
+  }
+  return below;
+}
+
+void RowBitmap::const_iterator::settle() noexcept {
+  for (; chunk < chunks->size(); ++chunk, pos = 0) {
+    const Chunk& c = (*chunks)[chunk];
+    if (c.bits.empty()) {
+      if (pos < c.array.size())
+        return;
+      continue;
+    }
+    for (size_t w = pos >> 6; w < BITSET_WORDS; ++w) {
+      // on the first word, bits before pos don't count
+      uint64_t word = c.bits[w] & (w == pos >> 6 ? ~uint64_t{0} << (pos & 63) : ~uint64_t{0});
+      if (word != 0) {
+        pos = (w << 6) | static_cast<size_t>(__builtin_ctzll(word));
+        return;
+      }
+    }
+  }
+}
+
+size_t RowBitmap::used_bytes() const noexcept {
+  size_t bytes = chunks.size() * sizeof(Chunk);
+  for (const Chunk& chunk : chunks)
+    bytes += chunk.array.size() * sizeof(uint16_t) + chunk.bits.size() * sizeof(uint64_t);
+  return bytes;
+}
+
+size_t RowBitmap::slack_bytes() const noexcept {
+  size_t bytes = (chunks.capacity() - chunks.size()) * sizeof(Chunk);
+  for (const Chunk& chunk : chunks)
+    bytes += (chunk.array.capacity() - chunk.array.size()) * sizeof(uint16_t) +
+             (chunk.bits.capacity() - chunk.bits.size()) * sizeof(uint64_t);
+  return bytes;
+}
+
+void RowBitmap::shrink_to_fit() {
+  chunks.shrink_to_fit();
+  for (Chunk& chunk : chunks)
+    chunk.array.shrink_to_fit();
+}
@@ -0,0 +1,88 @@
+// Project Identifier: C0F4DFE8B340D81183C208F70F9D2D797908754D
+
+// SillyQL bitmap index postings: a compressed set of row ids, roaring style.
+// Rows are split into chunks of 2^16 by their high bits; a chunk holding few
+// rows keeps them as a sorted array of 16 bit offsets, a busier one as a
+// 65536 bit bitset, whichever is smaller. A bool column's postings take about
+// a bit per row instead of a size_t, and counting is popcount.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <vector>
+
+
+class RowBitmap {
+  static constexpr size_t CHUNK_BITS = 16;
+  static constexpr size_t BITSET_WORDS = (size_t{1} << CHUNK_BITS) / 64;
+  // past this many rows the bitset (8 KiB) is smaller than the array
+  static constexpr size_t ARRAY_MAX = BITSET_WORDS * sizeof(uint64_t) / sizeof(uint16_t);
+
+  struct Chunk {
+    size_t key;                   // row >> CHUNK_BITS
+    std::vector<uint16_t> array;  // sorted low bits while the chunk is sparse
+    std::vector<uint64_t> bits;   // bitset once it isn't, array is then empty
+    size_t count = 0;
+  };
+
+  public:
+  // walks the rows in increasing order, so a bitmap reads like a posting list
+  class const_iterator {
+    public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = size_t;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const size_t*;
+    using reference = size_t;
+
+    size_t operator*() const noexcept {
+      const Chunk& c = (*chunks)[chunk];
+      return (c.key << CHUNK_BITS) | (c.bits.empty() ? c.array[pos] : pos);
+    }
+    const_iterator& operator++() noexcept {
+      ++pos;
+      settle();
+      return *this;
+    }
+    bool operator==(const const_iterator& other) const noexcept {
+      return chunk == other.chunk && pos == other.pos;
+    }
+    bool operator!=(const const_iterator& other) const noexcept { return !(*this == other); }
+
+    private:
+    friend class RowBitmap;
+    const_iterator(const std::vector<Chunk>* chunks_in, size_t chunk_in) noexcept
+        : chunks{chunks_in}, chunk{chunk_in} {
+      settle();
+    }
+    // moves to the first row at or after (chunk, pos)
+    void settle() noexcept;
+
+    const std::vector<Chunk>* chunks;
+    size_t chunk;
+    size_t pos = 0; // index into the array, or bit number in the bitset
+  };
+
+  // rows have to come in increasing order, same as a posting list, so that
+  // add_postings() in silly.cpp can fill either one
+  void push_back(size_t row);
+
+  size_t size() const noexcept { return cardinality; }
+  bool empty() const noexcept { return cardinality == 0; }
+  // rows below limit
+  size_t rank(size_t limit) const noexcept;
+
+  const_iterator begin() const noexcept { return const_iterator{&chunks, 0}; }
+  const_iterator end() const noexcept { return const_iterator{&chunks, chunks.size()}; }
+
+  // bytes the rows take, and bytes allocated beyond that
+  size_t used_bytes() const noexcept;
+  size_t slack_bytes() const noexcept;
+  void shrink_to_fit();
+
+  private:
+  std::vector<Chunk> chunks; // in key order
+  size_t cardinality = 0;
+};
@@ -0,0 +1,339 @@
+// Project Identifier: C0F4DFE8B340D81183C208F70F9D2D797908754D
+
+// SillyQL row storage, see RowStore.h
+
+#include "RowStore.h"
+
+#include <cerrno>
+#include <cmath>
+#include <new>
+#include <system_error>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// slabs aim for this many bytes, rounded down to a power of two rows so that
+// finding a row is a shift and a mask
+static constexpr size_t SLAB_TARGET_BYTES = 64 * 1024;
+
+RowStore::RowStore(std::vector<EntryType> column_types, bool pack_columns)
+    : types{std::move(column_types)}, cols{types.size()}, pack{pack_columns} {
+  size_t row_bytes = (cols == 0 ? 1 : cols) * sizeof(TableEntry) + sizeof(std::atomic<uint64_t>);
+  while ((size_t{2} << slab_shift) * row_bytes + zone_bytes() <= SLAB_TARGET_BYTES)
+    ++slab_shift;
+  slab_mask = (size_t{1} << slab_shift) - 1;
+  slab_stride = slab_bytes();
+}
+
+RowStore::RowStore(std::vector<EntryType> column_types, bool pack_columns, const std::string& backing_path)
+    : RowStore(std::move(column_types), pack_columns) {
+  fd = open(backing_path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+  if (fd < 0)
+    throw std::system_error(errno, std::generic_category(), backing_path);
+  backing = backing_path;
+  size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  slab_stride = (slab_bytes() + page - 1) / page * page;
+}
+
+RowStore::RowStore(RowStore&& other) noexcept
+    : types{std::move(other.types)}, cols{other.cols}, num_rows{other.num_rows}, slab_shift{other.slab_shift},
+      slab_mask{other.slab_mask}, num_slabs{other.num_slabs}, pack{other.pack}, fd{other.fd},
+      backing{std::move(other.backing)}, slab_stride{other.slab_stride}, dir{std::move(other.dir)},
+      alloc_stats{other.alloc_stats} {
+  other.num_slabs = 0;
+  other.num_rows = 0;
+  other.fd = -1;
+}
+
+RowStore& RowStore::operator=(RowStore&& other) noexcept {
+  if (this != &other) {
+    clear();
+    close_backing();
+    types = std::move(other.types);
+    cols = other.cols;
+    num_rows = other.num_rows;
+    slab_shift = other.slab_shift;
+    slab_mask = other.slab_mask;
+    num_slabs = other.num_slabs;
+    pack = other.pack;
+    fd = other.fd;
+    backing = std::move(other.backing);
+    slab_stride = other.slab_stride;
+    dir = std::move(other.dir);
+    alloc_stats = other.alloc_stats;
+    other.num_slabs = 0;
+    other.num_rows = 0;
+    other.fd = -1;
+  }
+  return *this;
+}
+
+RowStore::~RowStore() noexcept {
+  clear();
+  close_backing();
+}
+
+void RowStore::reserve(size_t rows) {
+  size_t needed = (rows + slab_mask) >> slab_shift;
+  if (needed > num_slabs)
+    grow_slabs(needed - num_slabs);
+}
+
+void RowStore::push_row(std::vector<TableEntry>& row) {
+  reserve(num_rows + 1);
+  TableEntry* cells = (*this)[num_rows];
+  for (size_t c = 0; c < cols; ++c)
+    new (&cells[c]) TableEntry{std::move(row[c])};
+  end_stamp(num_rows).store(LIVE, std::memory_order_relaxed);
+  widen_zones(num_rows);
+  ++num_rows;
+  if (pack && (num_rows & slab_mask) == 0)
+    pack_block((num_rows - 1) >> slab_shift);
+}
+
+void RowStore::erase_rows(const std::vector<bool>& doomed) {
+  for (size_t b = 0; b < num_slabs; ++b)
+    unpack_block(b);
+  // every slot in [keep, r) is raw memory: either a doomed row that was
+  // destroyed or a survivor that was moved down and destroyed
+  size_t keep = 0;
+  for (size_t r = 0; r < num_rows; ++r) {
+    if (doomed[r]) {
+      destroy_row(r);
+      continue;
+    }
+    if (keep != r) {
+      TableEntry* dst = (*this)[keep];
+      TableEntry* src = (*this)[r];
+      for (size_t c = 0; c < cols; ++c) {
+        new (&dst[c]) TableEntry{std::move(src[c])};
+        src[c].~TableEntry();
+      }
+      end_stamp(keep).store(end_stamp(r).load(std::memory_order_relaxed),
+                            std::memory_order_relaxed);
+    }
+    ++keep;
+  }
+  num_rows = keep;
+  shrink_slabs(num_slabs - ((num_rows + slab_mask) >> slab_shift));
+
+  // rows moved between blocks, so the zones start over
+  clear_zones();
+  for (size_t r = 0; r < num_rows; ++r)
+    widen_zones(r);
+  if (pack)
+    for (size_t b = 0; b < (num_rows >> slab_shift); ++b)
+      pack_block(b);
+}
+
+void RowStore::purge_dead() {
+  std::vector<bool> dead(num_rows);
+  bool any = false;
+  for (size_t r = 0; r < num_rows; ++r) {
+    dead[r] = !is_live(r);
+    any = any || dead[r];
+  }
+  if (any)
+    erase_rows(dead);
+}
+
+void RowStore::clear() noexcept {
+  for (size_t r = 0; r < num_rows; ++r)
+    destroy_row(r);
+  num_rows = 0;
+  shrink_slabs(num_slabs);
+}
+
+void RowStore::shrink_to_fit() noexcept {
+  if (!dir)
+    return;
+  size_t pages_used = (num_slabs + DIR_PAGE_SLABS - 1) >> DIR_PAGE_BITS;
+  for (size_t p = pages_used; p < DIR_PAGES && dir[p]; ++p)
+    dir[p].reset();
+}
+
+size_t RowStore::overhead_bytes() const noexcept {
+  if (!dir)
+    return 0;
+  size_t pages = 0;
+  while (pages < DIR_PAGES && dir[pages])
+    ++pages;
+  return DIR_PAGES * sizeof(DirPage) + pages * DIR_PAGE_SLABS * sizeof(TableEntry*) +
+         num_slabs * (rows_per_slab() * sizeof(std::atomic<uint64_t>) + zone_bytes());
+}
+
+size_t RowStore::packed_bytes() const noexcept {
+  size_t bytes = 0;
+  for (size_t b = 0; b < num_slabs; ++b)
+    for (size_t c = 0; c < cols; ++c)
+      if (const PackedColumn* column = packed(b, c))
+        bytes += column->used_bytes();
+  return bytes;
+}
+
+void RowStore::grow_slabs(size_t count) {
+  if (num_slabs + count > DIR_PAGES * DIR_PAGE_SLABS)
+    throw std::bad_alloc{};
+  if (!dir)
+    dir.reset(new DirPage[DIR_PAGES]);
+  for (size_t i = 0; i < count; ++i) {
+    DirPage& page = dir[num_slabs >> DIR_PAGE_BITS];
+    if (!page)
+      page.reset(new TableEntry*[DIR_PAGE_SLABS]);
+    TableEntry* fresh = (fd >= 0) ? map_slab(num_slabs) : static_cast<TableEntry*>(::operator new(slab_bytes()));
+    auto* stamps = reinterpret_cast<std::atomic<uint64_t>*>(fresh + rows_per_slab() * cols);
+    for (size_t r = 0; r < rows_per_slab(); ++r)
+      new (&stamps[r]) std::atomic<uint64_t>{LIVE};
+    // every zone starts out empty, lo = inf and hi = -inf
+    auto* zones = reinterpret_cast<std::atomic<double>*>(stamps + rows_per_slab());
+    for (size_t z = 0; z < 2 * cols; ++z)
+      new (&zones[z]) std::atomic<double>{(z % 2 == 0 ? 1 : -1) * std::numeric_limits<double>::infinity()};
+    if (pack)
+      for (size_t c = 0; c < cols; ++c)
+        new (&reinterpret_cast<std::atomic<const PackedColumn*>*>(zones + 2 * cols)[c])
+            std::atomic<const PackedColumn*>{nullptr};
+    page[num_slabs & (DIR_PAGE_SLABS - 1)] = fresh;
+    ++num_slabs;
+    ++alloc_stats.slab_allocs;
+    ++alloc_stats.live_slabs;
+    alloc_stats.slab_bytes += slab_bytes();
+  }
+}
+
+TableEntry* RowStore::map_slab(size_t s) {
+  if ((s & (DIR_PAGE_SLABS - 1)) != 0)
+    return reinterpret_cast<TableEntry*>(reinterpret_cast<char*>(slab(s - 1)) + slab_stride);
+  // allocate the blocks up front so that running out of disk is bad_alloc here
+  // instead of SIGBUS on some later write into the mapping
+  off_t offset = static_cast<off_t>((s >> DIR_PAGE_BITS) * chunk_bytes());
+  if (posix_fallocate(fd, offset, static_cast<off_t>(chunk_bytes())) != 0)
+    throw std::bad_alloc{};
+  void* chunk = mmap(nullptr, chunk_bytes(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, offset);
+  if (chunk == MAP_FAILED)
+    throw std::bad_alloc{};
+  return static_cast<TableEntry*>(chunk);
+}
+
+void RowStore::close_backing() noexcept {
+  if (fd < 0)
+    return;
+  close(fd);
+  unlink(backing.c_str());
+  fd = -1;
+}
+
+void RowStore::advise_sequential(size_t rows, bool sequential) const noexcept {
+  if (fd < 0)
+    return;
+  for (size_t s = 0; s < ((rows + slab_mask) >> slab_shift); s += DIR_PAGE_SLABS)
+    madvise(slab(s), chunk_bytes(), sequential ? MADV_SEQUENTIAL : MADV_NORMAL);
+}
+
+void RowStore::shrink_slabs(size_t count) noexcept {
+  for (size_t i = 0; i < count; ++i) {
+    --num_slabs;
+    unpack_block(num_slabs);
+    if (fd < 0) {
+      ::operator delete(slab(num_slabs));
+    } else if ((num_slabs & (DIR_PAGE_SLABS - 1)) == 0) {
+      // the last slab of its chunk, the whole chunk goes back
+      munmap(slab(num_slabs), chunk_bytes());
+      if (ftruncate(fd, static_cast<off_t>((num_slabs >> DIR_PAGE_BITS) * chunk_bytes())) != 0) {
+        // the file just stays longer than it needs to be
+      }
+    }
+    ++alloc_stats.slab_frees;
+    --alloc_stats.live_slabs;
+    alloc_stats.slab_bytes -= slab_bytes();
+  }
+}
+
+void RowStore::destroy_row(size_t r) noexcept {
+  TableEntry* cells = (*this)[r];
+  for (size_t c = 0; c < cols; ++c)
+    cells[c].~TableEntry();
+}
+
+void RowStore::clear_zones() noexcept {
+  for (size_t b = 0; b < num_slabs; ++b) {
+    for (size_t c = 0; c < cols; ++c) {
+      std::atomic<double>* z = zone_bounds(b, c);
+      z[0].store(std::numeric_limits<double>::infinity(), std::memory_order_relaxed);
+      z[1].store(-std::numeric_limits<double>::infinity(), std::memory_order_relaxed);
+    }
+  }
+}
+
+void RowStore::widen_zones(size_t r) noexcept {
+  const TableEntry* cells = (*this)[r];
+  for (size_t c = 0; c < cols; ++c) {
+    double val = 0;
+    switch (types[c]) {
+      case EntryType::String:
+        continue;
+      case EntryType::Double:
+        val = cells[c].as<double>();
+        break;
+      case EntryType::Int:
+        val = cells[c].as<int>();
+        break;
+      case EntryType::Bool:
+        val = cells[c].as<bool>() ? 1 : 0;
+        break;
+    }
+    // only the writer stores zones, readers may load them at any time
+    std::atomic<double>* z = zone_bounds(r >> slab_shift, c);
+    if (std::isnan(val)) {
+      z[0].store(-std::numeric_limits<double>::infinity(), std::memory_order_relaxed);
+      z[1].store(std::numeric_limits<double>::infinity(), std::memory_order_relaxed);
+      continue;
+    }
+    if (val < z[0].load(std::memory_order_relaxed))
+      z[0].store(val, std::memory_order_relaxed);
+    if (val > z[1].load(std::memory_order_relaxed))
+      z[1].store(val, std::memory_order_relaxed);
+  }
+}
+
+void RowStore::pack_block(size_t block) {
+  size_t first = block << slab_shift;
+  for (size_t c = 0; c < cols; ++c) {
+    PackedColumn column;
+    switch (types[c]) {
+      case EntryType::String:
+        continue;
+      case EntryType::Double: {
+        std::vector<double> values(rows_per_slab());
+        for (size_t i = 0; i < values.size(); ++i)
+          values[i] = (*this)[first + i][c].as<double>();
+        column = PackedColumn::pack_doubles(values);
+        break;
+      }
+      case EntryType::Int: {
+        std::vector<int64_t> values(rows_per_slab());
+        for (size_t i = 0; i < values.size(); ++i)
+          values[i] = (*this)[first + i][c].as<int>();
+        column = PackedColumn::pack_ints(values);
+        break;
+      }
+      case EntryType::Bool: {
+        std::vector<bool> values(rows_per_slab());
+        for (size_t i = 0; i < values.size(); ++i)
+          values[i] = (*this)[first + i][c].as<bool>();
+        column = PackedColumn::pack_bools(values);
+        break;
+      }
+    }
+    // published whole, a reader either sees it done or not at all
+    packed_slot(block, c).store(new PackedColumn(std::move(column)), std::memory_order_release);
+  }
+}
+
+void RowStore::unpack_block(size_t block) noexcept {
+  if (!pack)
+    return;
+  for (size_t c = 0; c < cols; ++c)
+    delete packed_slot(block, c).exchange(nullptr, std::memory_order_relaxed);
+}
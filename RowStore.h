@@ -0,0 +1,225 @@
+// Project Identifier: C0F4DFE8B340D81183C208F70F9D2D797908754D
+
+// SillyQL row storage: rows packed back to back in fixed size slabs owned by
+// the table, so inserting a row is a placement new into memory that is
+// already there instead of one heap allocation per row.
+//
+// Rows are also versioned for snapshot reads. A row is visible to a reader
+// if it was published before the reader's snapshot (it is below the
+// snapshot's row count) and was not deleted at or before the snapshot's
+// timestamp (its end stamp is later). DELETE only stamps rows; they are
+// physically removed by purge_dead() once no snapshot can still see them.
+// Slabs never move and the slab directory never reallocates, so one writer
+// can append while readers look at rows below their snapshot's row count.
+//
+// Each slab doubles as a zone map block: it keeps the min and max of every
+// int, double and bool column over its rows, so a scan can pass over blocks
+// whose range can't satisfy a predicate. Zones only ever widen until rows
+// move (erase_rows), which recomputes them; deleted rows that are still
+// waiting to be purged keep them wide, which is safe.
+//
+// A store made with pack_columns also keeps a PackedColumn copy of every
+// int, double and bool column of each full slab, for scans. The copies are
+// extra memory beside the cells, which stay where they are.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <limits>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "PackedColumn.h"
+#include "TableEntry.h"
+
+
+// what one reader sees of a table
+struct Snapshot {
+  uint64_t ts = 0;       // commit timestamp the snapshot was taken at
+  size_t rows = 0;       // rows published at that point (physical row ids below this)
+  size_t live = 0;       // how many of them are visible
+  bool filtered = false; // some of them were already deleted, check end stamps
+  uint64_t version = 0;  // bumped by every write that can change what a reader sees
+};
+
+
+class RowStore {
+  public:
+  // allocator counters, all in bytes/calls since the store was created
+  struct Stats {
+    size_t slab_allocs = 0;   // calls to operator new for slabs
+    size_t slab_frees = 0;    // slabs handed back
+    size_t live_slabs = 0;
+    size_t slab_bytes = 0;    // bytes held in live slabs
+  };
+
+  // min and max of one column over one block, as doubles. An empty block has
+  // lo > hi; a NaN in the block makes it [-inf, inf].
+  struct Zone {
+    double lo;
+    double hi;
+  };
+
+  // end stamp of a row nobody has deleted
+  static constexpr uint64_t LIVE = UINT64_MAX;
+
+  explicit RowStore(std::vector<EntryType> column_types = {}, bool pack_columns = false);
+  // slabs in backing_path, a new file created here; throws std::system_error if it
+  // can't be, an existing file included, which is never reused or truncated
+  RowStore(std::vector<EntryType> column_types, bool pack_columns, const std::string& backing_path);
+  RowStore(RowStore&&) noexcept;
+  RowStore& operator=(RowStore&&) noexcept;
+  // rows hold strings, a copy would have to deep copy every cell
+  RowStore(const RowStore&) = delete;
+  RowStore& operator=(const RowStore&) = delete;
+  ~RowStore() noexcept;
+
+  // physical rows, including deleted ones not purged yet (writer side only,
+  // readers use their Snapshot's row count)
+  size_t size() const noexcept { return num_rows; }
+  bool empty() const noexcept { return num_rows == 0; }
+  size_t num_cols() const noexcept { return cols; }
+  size_t rows_per_slab() const noexcept { return slab_mask + 1; }
+
+  // a row is num_cols() contiguous cells, so table2D[r][c] still works
+  TableEntry* operator[](size_t r) noexcept {
+    return slab(r >> slab_shift) + (r & slab_mask) * cols;
+  }
+  const TableEntry* operator[](size_t r) const noexcept {
+    return slab(r >> slab_shift) + (r & slab_mask) * cols;
+  }
+
+  // versioning
+  void kill(size_t r, uint64_t ts) noexcept {
+    end_stamp(r).store(ts, std::memory_order_relaxed);
+  }
+  bool is_live(size_t r) const noexcept {
+    return end_stamp(r).load(std::memory_order_relaxed) == LIVE;
+  }
+  bool visible(size_t r, const Snapshot& snap) const noexcept {
+    return r < snap.rows &&
+           (!snap.filtered || end_stamp(r).load(std::memory_order_relaxed) > snap.ts);
+  }
+
+  // zone maps; a block is a slab, rows [block * rows_per_slab(), (block + 1) * rows_per_slab())
+  bool zoned(size_t col) const noexcept { return types[col] != EntryType::String; }
+  Zone zone(size_t block, size_t col) const noexcept {
+    const std::atomic<double>* z = zone_bounds(block, col);
+    return Zone{z[0].load(std::memory_order_relaxed), z[1].load(std::memory_order_relaxed)};
+  }
+  // block's packed copy of col, or nullptr while the block isn't full (or
+  // the store doesn't pack, or col holds strings)
+  const PackedColumn* packed(size_t block, size_t col) const noexcept {
+    if (!pack || !zoned(col))
+      return nullptr;
+    return packed_slot(block, col).load(std::memory_order_acquire);
+  }
+
+  // makes sure rows [0, num_rows) have slabs behind them, one allocation per slab
+  void reserve(size_t num_rows);
+  // moves the num_cols() cells of row into a new last row; row is left moved-from
+  void push_row(std::vector<TableEntry>& row);
+  // drops every row r with doomed[r] set, keeps the rest in order, and frees
+  // the slabs that end up past the last row. Moves rows, so no reader may
+  // be looking.
+  void erase_rows(const std::vector<bool>& doomed);
+  // erase_rows() on every row that has been killed
+  void purge_dead();
+  // destroys every row and frees every slab
+  void clear() noexcept;
+  // rows the current slabs can hold without allocating
+  size_t capacity() const noexcept { return num_slabs << slab_shift; }
+  // frees directory pages past the last slab
+  void shrink_to_fit() noexcept;
+  // bytes of bookkeeping outside the cells: the slab directory, end stamps and zones
+  size_t overhead_bytes() const noexcept;
+  // bytes held by packed copies of full slabs
+  size_t packed_bytes() const noexcept;
+
+  const Stats& stats() const noexcept { return alloc_stats; }
+  bool file_backed() const noexcept { return fd >= 0; }
+  // tells the OS whether the mapped slabs of rows [0, rows) are about to be
+  // read front to back (more read ahead, pages dropped sooner behind) or not;
+  // no-op on the heap
+  void advise_sequential(size_t rows, bool sequential) const noexcept;
+
+  private:
+  // two level slab directory: a fixed array of pages that are filled in as
+  // slabs get added, so growing never moves an entry a reader might be using.
+  // 1024 pages of 256 slabs caps a table at 16 GiB of cells.
+  static constexpr size_t DIR_PAGE_BITS = 8;
+  static constexpr size_t DIR_PAGE_SLABS = size_t{1} << DIR_PAGE_BITS;
+  static constexpr size_t DIR_PAGES = 1024;
+  using DirPage = std::unique_ptr<TableEntry*[]>;
+
+  std::vector<EntryType> types;
+  size_t cols;
+  size_t num_rows = 0;
+  size_t slab_shift = 0;
+  size_t slab_mask = 0;
+  size_t num_slabs = 0;
+  bool pack = false;
+  int fd = -1;               // backing file, or -1 for heap slabs
+  std::string backing;
+  size_t slab_stride = 0;    // bytes from one mapped slab to the next, whole pages
+  std::unique_ptr<DirPage[]> dir; // allocated with the first slab
+  Stats alloc_stats;
+
+  TableEntry* slab(size_t s) const noexcept {
+    return dir[s >> DIR_PAGE_BITS][s & (DIR_PAGE_SLABS - 1)];
+  }
+  // end stamps sit in the slab right after its cells
+  std::atomic<uint64_t>& end_stamp(size_t r) const noexcept {
+    TableEntry* base = slab(r >> slab_shift);
+    return reinterpret_cast<std::atomic<uint64_t>*>(base + rows_per_slab() * cols)[r & slab_mask];
+  }
+  // then the zones, lo and hi for every column
+  std::atomic<double>* zone_bounds(size_t block, size_t col) const noexcept {
+    TableEntry* base = slab(block);
+    auto* stamps = reinterpret_cast<std::atomic<uint64_t>*>(base + rows_per_slab() * cols);
+    return reinterpret_cast<std::atomic<double>*>(stamps + rows_per_slab()) + 2 * col;
+  }
+  // and, when packing, a pointer to every column's packed copy
+  std::atomic<const PackedColumn*>& packed_slot(size_t block, size_t col) const noexcept {
+    return reinterpret_cast<std::atomic<const PackedColumn*>*>(zone_bounds(block, 0) + 2 * cols)[col];
+  }
+  size_t cell_bytes() const noexcept { return rows_per_slab() * cols * sizeof(TableEntry); }
+  size_t zone_bytes() const noexcept {
+    return 2 * cols * sizeof(std::atomic<double>) + (pack ? cols * sizeof(std::atomic<const PackedColumn*>) : 0);
+  }
+  size_t slab_bytes() const noexcept {
+    return cell_bytes() + rows_per_slab() * sizeof(std::atomic<uint64_t>) + zone_bytes();
+  }
+  size_t chunk_bytes() const noexcept { return DIR_PAGE_SLABS * slab_stride; }
+  // the next slab in the backing file, mapping its directory page's chunk if it starts one
+  TableEntry* map_slab(size_t s);
+  void close_backing() noexcept;
+  void grow_slabs(size_t count);
+  void shrink_slabs(size_t count) noexcept;
+  void destroy_row(size_t r) noexcept;
+  // empties every block's zones
+  void clear_zones() noexcept;
+  void widen_zones(size_t r) noexcept;
+  // packs every non-string column of a full block
+  void pack_block(size_t block);
+  void unpack_block(size_t block) noexcept;
+};
+
+
+// a scan's madvise hint on the mapped slabs it reads, for as long as it lives
+class SequentialScan {
+  public:
+  SequentialScan(const RowStore& table2D, size_t rows) : store{table2D}, num_rows{rows} {
+    store.advise_sequential(num_rows, true);
+  }
+  ~SequentialScan() { store.advise_sequential(num_rows, false); }
+  SequentialScan(const SequentialScan&) = delete;
+  SequentialScan& operator=(const SequentialScan&) = delete;
+
+  private:
+  const RowStore& store;
+  size_t num_rows;
+};
@@ -0,0 +1,141 @@
+// Project Identifier: C0F4DFE8B340D81183C208F70F9D2D797908754D
+
+// SillyQL server mode plumbing, see SocketStream.h
+
+#include "SocketStream.h"
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// write all of buf, retrying short writes; MSG_NOSIGNAL so a peer that hung
+// up is an error return instead of SIGPIPE
+static bool send_all(int fd, const char* buf, size_t len) {
+  while (len > 0) {
+    ssize_t sent = send(fd, buf, len, MSG_NOSIGNAL);
+    if (sent < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    buf += sent;
+    len -= static_cast<size_t>(sent);
+  }
+  return true;
+}
+
+FdStreamBuf::FdStreamBuf(int fd_in) : fd{fd_in} {
+  setg(in_buf, in_buf, in_buf);
+  setp(out_buf, out_buf + BUF_SIZE);
+}
+
+FdStreamBuf::~FdStreamBuf() {
+  flush_out();
+}
+
+FdStreamBuf::int_type FdStreamBuf::underflow() {
+  if (gptr() < egptr())
+    return traits_type::to_int_type(*gptr());
+  ssize_t got;
+  do {
+    got = read(fd, in_buf, BUF_SIZE);
+  } while (got < 0 && errno == EINTR);
+  if (got <= 0)
+    return traits_type::eof();
+  setg(in_buf, in_buf, in_buf + got);
+  return traits_type::to_int_type(*gptr());
+}
+
+FdStreamBuf::int_type FdStreamBuf::overflow(int_type ch) {
+  if (!flush_out())
+    return traits_type::eof();
+  if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+    *pptr() = traits_type::to_char_type(ch);
+    pbump(1);
+  }
+  return traits_type::not_eof(ch);
+}
+
+int FdStreamBuf::sync() {
+  return flush_out() ? 0 : -1;
+}
+
+bool FdStreamBuf::flush_out() {
+  bool ok = send_all(fd, pbase(), static_cast<size_t>(pptr() - pbase()));
+  setp(out_buf, out_buf + BUF_SIZE);
+  return ok;
+}
+
+static bool make_address(const std::string& path, sockaddr_un& addr) {
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path))
+    return false;
+  std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+  return true;
+}
+
+int listen_unix(const std::string& path) {
+  sockaddr_un addr;
+  if (!make_address(path, addr))
+    return -1;
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+  unlink(path.c_str());
+  if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 ||
+      listen(fd, SOMAXCONN) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int connect_unix(const std::string& path) {
+  sockaddr_un addr;
+  if (!make_address(path, addr))
+    return -1;
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+  if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int run_client(const std::string& path) {
+  int fd = connect_unix(path);
+  if (fd < 0) {
+    std::cerr << "Could not connect to " << path << '\n';
+    return 1;
+  }
+
+  // stdin goes up on its own thread; once it runs dry the server sees EOF
+  std::thread sender([fd] {
+    char buf[4096];
+    ssize_t got;
+    while ((got = read(STDIN_FILENO, buf, sizeof(buf))) > 0) {
+      if (!send_all(fd, buf, static_cast<size_t>(got)))
+        break;
+    }
+    shutdown(fd, SHUT_WR);
+  });
+  // the server may hang up (QUIT) while stdin is still open, don't wait on it
+  sender.detach();
+
+  char buf[4096];
+  ssize_t got;
+  while ((got = read(fd, buf, sizeof(buf))) > 0) {
+    if (write(STDOUT_FILENO, buf, static_cast<size_t>(got)) < 0)
+      break;
+  }
+  close(fd);
+  return 0;
+}
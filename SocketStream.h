@@ -0,0 +1,41 @@
+// Project Identifier: C0F4DFE8B340D81183C208F70F9D2D797908754D
+
+// SillyQL server mode plumbing: iostreams over a connected socket, plus the
+// Unix domain socket setup for the server (-s) and the client (-c).
+
+#pragma once
+
+#include <streambuf>
+#include <string>
+
+
+// buffered streambuf over a file descriptor, so a session can use the same
+// >> and << code as stdin mode. Does not own (close) the descriptor.
+class FdStreamBuf : public std::streambuf {
+  public:
+  explicit FdStreamBuf(int fd);
+  FdStreamBuf(const FdStreamBuf&) = delete;
+  FdStreamBuf& operator=(const FdStreamBuf&) = delete;
+  ~FdStreamBuf() override;
+
+  protected:
+  int_type underflow() override;
+  int_type overflow(int_type ch) override;
+  int sync() override;
+
+  private:
+  static constexpr size_t BUF_SIZE = 4096;
+  int fd;
+  char in_buf[BUF_SIZE];
+  char out_buf[BUF_SIZE];
+
+  bool flush_out();
+};
+
+// bound and listening socket at path (replacing a stale one), or -1
+int listen_unix(const std::string& path);
+// socket connected to the server at path, or -1
+int connect_unix(const std::string& path);
+// client mode: sends stdin to the server at path and copies its replies to
+// stdout until the server hangs up. Returns the process exit status.
+int run_client(const std::string& path);
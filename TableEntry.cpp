@@ -7,6 +7,8 @@
 
 #include <functional>
 #include <cassert>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
 #include <utility>
 #include <exception>
@@ -80,18 +82,55 @@ template <> bool TableEntry::as<bool>() const noexcept {
 }
 
 
+// wyhash style mixing: multiply out to 128 bits and fold the halves, so
+// every input bit reaches every output bit. std::hash<int> and
+// std::hash<double> hand back the value itself, which piles sequential and
+// strided keys into neighbouring buckets.
+static constexpr uint64_t HASH_P0 = 0xa0761d6478bd642full;
+static constexpr uint64_t HASH_P1 = 0xe7037ed1a0b428dbull;
+
+static inline uint64_t hash_mix(uint64_t a, uint64_t b) noexcept {
+  __uint128_t r = static_cast<__uint128_t>(a) * b;
+  return static_cast<uint64_t>(r) ^ static_cast<uint64_t>(r >> 64);
+}
+
+static inline uint64_t hash_word(uint64_t x) noexcept {
+  return hash_mix(hash_mix(x ^ HASH_P0, HASH_P1), x ^ HASH_P1);
+}
+
+static inline uint64_t read_word(const char* p) noexcept {
+  uint64_t w;
+  memcpy(&w, p, sizeof(w));
+  return w;
+}
+
+static uint64_t hash_bytes(const char* p, size_t len) noexcept {
+  uint64_t seed = hash_mix(len ^ HASH_P0, HASH_P1);
+  for (; len > 16; len -= 16, p += 16)
+    seed = hash_mix(read_word(p) ^ HASH_P1, read_word(p + 8) ^ seed);
+  // last 1-16 bytes, zero padded
+  char tail[16] = {};
+  memcpy(tail, p, len);
+  return hash_mix(HASH_P1 ^ seed, hash_mix(read_word(tail) ^ HASH_P1, read_word(tail + 8) ^ seed));
+}
+
 namespace std {
 // overload to std::hash
 size_t hash<TableEntry>::operator()(const TableEntry& tt) const noexcept {
   switch (tt.tag) {
   case EntryType::String:
-    return hash<string>{}(tt.data_string);
-  case EntryType::Double:
-    return hash<double>{}(tt.data_double);
+    return hash_bytes(tt.data_string.data(), tt.data_string.size());
+  case EntryType::Double: {
+    // 0.0 == -0.0, so they have to hash alike
+    uint64_t bits = 0;
+    if (tt.data_double != 0)
+      memcpy(&bits, &tt.data_double, sizeof(bits));
+    return hash_word(bits);
+  }
   case EntryType::Int:
-    return hash<int>{}(tt.data_int);
+    return hash_word(static_cast<uint64_t>(static_cast<int64_t>(tt.data_int)));
   case EntryType::Bool:
-    return hash<bool>{}(tt.data_bool);
+    return hash_word(tt.data_bool);
   }
   terminate();
 }
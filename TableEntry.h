@@ -7,6 +7,7 @@
 
 #include <utility>
 #include <string>
+#include <functional>
 #include <iosfwd>
 #include <cassert>
 #include <exception>
@@ -114,10 +115,15 @@ class TableEntry {
           typename std::decay<T>::type>::type>::type>::type;
 
 
+  public:
   // as<T> operator to use the TableEntry as if it were type T. Only implemented
   // for the types allowed as TableEntry and returns a const& for string.
+  // Public so code that already knows a column's type (aggregates, typed scans)
+  // can read the value without going through the tag switch for every row.
   template <typename T> fast_pass<T> as() const noexcept;
 
+  private:
+
   // helper for comparisons with other TableEntry.
   // Change to template <template <typename> typename COMP> in c++17
   template <template <typename> class COMP>
@@ -138,6 +144,14 @@ namespace std {
 template <> struct hash<TableEntry> {
   size_t operator()(const TableEntry&) const noexcept;
 };
+
+#ifdef __GLIBCXX__
+// libstdc++ only keeps each node's hash next to its key when the hash is not
+// marked fast. Ours reads whole strings, so have it keep them: a rehash never
+// hashes a key again and a probe only compares keys whose hashes match.
+// (libc++ always keeps them.)
+template <> struct __is_fast_hash<hash<TableEntry>> : false_type {};
+#endif
 }
 
 // You can print TableEntry, it just prints the internal value.
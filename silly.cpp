@@ -2,144 +2,711 @@
 
 //STL Libraries
 #include <iostream>
+#include <cassert>
 #include <queue>
+#include <deque>
 #include <cmath>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
 #include <string>
 #include <algorithm>
+#include <numeric>
 #include <vector>
 #include <iterator>
 #include <map>
 #include <unordered_map>
+#include <unordered_set>
 #include <getopt.h>
 #include <sstream>
+#include <shared_mutex>
+#include <mutex>
+#include <thread>
+#include <memory>
+#include <optional>
+#include <type_traits>
+#include <exception>
+#include <system_error>
+#include <cerrno>
+#include <chrono>
+#include <fstream>
+#include <atomic>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
 
 #include "TableEntry.h"
+#include "RowStore.h"
+#include "PackedColumn.h"
+#include "RowBitmap.h"
+#include "BloomFilter.h"
+#include "ProbeTable.h"
+#include "CrackerColumn.h"
+#include "ResultCache.h"
+#include "SocketStream.h"
+#include "CommandScheduler.h"
 //other files
 
 enum class IndexType : uint8_t {
     HASH,
     BST,
+    BITMAP, // bst keyed the same way, postings kept as compressed bitmaps (see RowBitmap.h)
     NONE
 };
 
-struct Table {
-    //default constructor?
+// per-table and catalog latches: any number of readers, or one writer
+using ReadLock = std::shared_lock<std::shared_mutex>;
+using WriteLock = std::unique_lock<std::shared_mutex>;
 
-    std::string table_name;
-    bool quiet = false;
+// one term of a WHERE clause: <colname> <op> <value>, or <colname> BETWEEN <value> AND <value_hi>
+struct Predicate {
+    size_t col;
+    char op; // '<', '>', '=' or 'B' for BETWEEN (inclusive on both ends)
+    TableEntry value;
+    TableEntry value_hi; // only meaningful for BETWEEN, otherwise a copy of value
 
-    std::vector<EntryType> columnTypes;
-    std::vector<std::string> columnNames;
-    std::vector<std::vector<TableEntry>> table2D;
-    std::map<TableEntry, std::vector<size_t>>bst;
-    std::unordered_map <TableEntry, std::vector<size_t>> hashTable;
-    IndexType index_type = IndexType::NONE;
-    size_t col_of_generated_index;
-    bool can_use_generated_index = false;
+    Predicate(size_t col_in, char op_in, const TableEntry& lo, const TableEntry& hi)
+        : col(col_in), op(op_in), value(lo), value_hi(hi) {}
+};
 
-struct equal {
-private:
-    size_t index_;
-    TableEntry entry_;
-    EntryType columnType_;
-    static constexpr double EPSILON = 1e-9;
+// terms ORed together from groups of ANDed terms, AND binds tighter: a AND b OR c -> {{a, b}, {c}}
+using WhereClause = std::vector<std::vector<Predicate>>;
 
-public:
-    equal(size_t index, const TableEntry& entry, EntryType columnType)
-        : index_(index), entry_(entry), columnType_(columnType) {}
+// what a block's zone map says about a WHERE term, see RowStore.h
+enum class ZoneMatch : uint8_t {
+    NONE, // no row in the block can pass
+    SOME, // rows have to be checked
+    ALL   // every row passes (e.g. the whole block holds one value and it's the one asked for)
+};
 
-    bool operator()(const std::vector<TableEntry>& table_entry) const {
-        if (columnType_ == EntryType::Double) {
-            std::ostringstream entryStream, tableStream;
-            
-            entryStream << entry_;
-            tableStream << table_entry[index_];
+// optional ORDER BY <colname> [ASC|DESC] [LIMIT <k>] tail of a PRINT
+struct OrderBy {
+    bool active = false; // false: keep the natural order, LIMIT may still apply
+    size_t col = 0;
+    bool descending = false;
+    size_t limit = SIZE_MAX;
+};
+
+// what a table is holding on to, in bytes, as reported by MEMORY
+struct MemoryUsage {
+    size_t data = 0;    // live cells in the row slabs
+    size_t index = 0;   // generated index nodes, buckets and row lists
+    size_t strings = 0; // string bytes on the heap (short strings live inside their cell)
+    size_t slack = 0;   // allocated but unused: slab tails, spare buckets, spare capacity
+
+    size_t total() const { return data + index + strings + slack; }
+    MemoryUsage& operator+=(const MemoryUsage& other){
+        data += other.data;
+        index += other.index;
+        strings += other.strings;
+        slack += other.slack;
+        return *this;
+    }
+};
 
-            std::string entryString = entryStream.str();
-            std::string tableString = tableStream.str();
+// one <AGG> <colname> pair of a GROUP command
+struct Aggregate {
+    std::string func; // COUNT, SUM, MIN, MAX or AVG
+    size_t col;
+};
 
-            double entryValue = std::stof(entryString);
-            double tableValue = std::stof(tableString);
+// per-group results of one aggregate: COUNT and int SUM/MIN/MAX stay integral, the rest are doubles
+struct AggregateResult {
+    bool integral = true;
+    std::vector<long long> ints;
+    std::vector<double> reals;
+};
 
-            double diff = std::abs(entryValue - tableValue);
-            return diff < EPSILON;
-        } else {
-            switch (columnType_) {
-                case EntryType::Int:
-                    return table_entry[index_] == entry_;
-                case EntryType::String:
-                    return table_entry[index_] == entry_;
-                case EntryType::Bool:
-                    return table_entry[index_] == entry_;
-                default:
-                    throw std::runtime_error("Unsupported type for comparison");
+// one table's (or partition's) share of a GROUP: its groups in output order with a row from each,
+// their sizes and one result per aggregate
+struct GroupResult {
+    bool key_ordered = false; // groups came off a bst or bitmap index, so they're in key order
+    std::vector<size_t> first_rows;
+    std::vector<size_t> counts;
+    std::vector<AggregateResult> results;
+};
+
+// runs f(p) for p in [0, num_parts), each on its own thread when there's more than one;
+// the first exception thrown is rethrown once they're all done
+template <typename F>
+static void run_parts(size_t num_parts, F f){
+    if (num_parts == 1){
+        f(0);
+        return;
+    }
+    std::vector<std::exception_ptr> errors(num_parts);
+    std::vector<std::thread> workers;
+    workers.reserve(num_parts);
+    for (size_t p = 0; p < num_parts; ++p){
+        workers.emplace_back([&f, &errors, p](){
+            try {
+                f(p);
+            } catch (...) {
+                errors[p] = std::current_exception();
             }
+        });
+    }
+    for (std::thread& worker : workers){
+        worker.join();
+    }
+    for (const std::exception_ptr& error : errors){
+        if (error){
+            std::rethrow_exception(error);
+        }
+    }
+}
+
+// a std::thread that gets joined instead of terminating the program when it goes away or is replaced
+struct JoiningThread {
+    std::thread thread;
+
+    JoiningThread() = default;
+    explicit JoiningThread(std::thread thread_in) : thread(std::move(thread_in)) {}
+    JoiningThread(JoiningThread&&) = default;
+    JoiningThread& operator=(JoiningThread&& other){
+        join();
+        thread = std::move(other.thread);
+        return *this;
+    }
+    ~JoiningThread(){ join(); }
+
+    void join(){
+        if (thread.joinable()){
+            thread.join();
         }
     }
 };
 
-    struct less {
-        private:
-            size_t index_;
-            TableEntry entry_;
-        public:
-            less(size_t index, const TableEntry &entry): index_(index), entry_(entry){};
-            bool operator()(const std::vector<TableEntry> &table_entry){
-                return table_entry[index_] < entry_;
+// hash, bst or bitmap as GENERATE spells it
+static IndexType index_type_named(const std::string& name){
+    return (name == "hash") ? IndexType::HASH : (name == "bst") ? IndexType::BST : IndexType::BITMAP;
+}
+
+// an index on its way in: postings go into the map for its type, the other two stay empty
+struct IndexBuild {
+    IndexType type;
+    size_t col;
+    std::unordered_map<TableEntry, std::vector<size_t>> hash;
+    std::map<TableEntry, std::vector<size_t>> bst;
+    std::map<TableEntry, RowBitmap> bitmaps;
+
+    IndexBuild(IndexType type_in, size_t col_in) : type(type_in), col(col_in) {}
+    void add_rows(const RowStore& table2D, size_t first, size_t last);
+};
+
+// an index GENERATE ... LAZY asked for, not built until a WHERE can use it
+struct DeferredIndex {
+    IndexType type;
+    size_t col;
+
+    // whether the index could answer one of the clause's terms
+    bool serves(const WhereClause& where) const {
+        for (const std::vector<Predicate>& conjunction : where){
+            for (const Predicate& pred : conjunction){
+                if (pred.col == col && (type != IndexType::HASH || pred.op == '=')){
+                    return true;
+                }
             }
-            operator bool() const{return true;}
+        }
+        return false;
+    }
+};
+
+struct Table {
+    //default constructor?
+
+    std::string table_name;
+    bool quiet = false;
+    bool adaptive = false; // -a: unindexed range terms crack their column instead of scanning it
+
+    std::vector<EntryType> columnTypes;
+    std::vector<std::string> columnNames;
+    std::unordered_map<std::string, size_t> column_ids; // name -> index in columnNames, the first column wins a duplicate name
+    RowStore table2D; // rows live in table-owned slabs, see RowStore.h
+    // PARTITION BY HASH(<colname>) <N>: rows are spread over N partitions by the hash of their key, each a
+    // Table of its own (rows, index, latches, versions); this one keeps the schema and stays empty.
+    // Writers hold every partition's latch and publish under this table's versions mutex, readers take
+    // their snapshots under it, so a write shows up in all partitions at once
+    std::vector<Table> partitions;
+    size_t partition_col = 0;
+    std::map<TableEntry, std::vector<size_t>>bst;
+    std::unordered_map <TableEntry, std::vector<size_t>> hashTable;
+    std::map<TableEntry, RowBitmap> bitmaps;
+    IndexType index_type = IndexType::NONE;
+    size_t col_of_generated_index;
+    bool can_use_generated_index = false;
+    // INSERT/DELETE/GENERATE/COMPACT take it alone, MEMORY shares it; PRINT/JOIN/GROUP read a Snapshot instead (server mode)
+    std::unique_ptr<std::shared_mutex> latch = std::make_unique<std::shared_mutex>();
+    // guards bst/hashTable/bitmaps and the index fields: snapshot readers share it, writers change the index under it alone
+    std::unique_ptr<std::shared_mutex> index_latch = std::make_unique<std::shared_mutex>();
+
+    // MVCC bookkeeping. DELETE bumps commit_ts and stamps its rows with it, INSERT publishes rows by
+    // raising published_rows; deleted rows stay in table2D until no snapshot is left to see them
+    struct Versions {
+        std::mutex mutex;
+        uint64_t commit_ts = 0;
+        size_t published_rows = 0;
+        size_t live_rows = 0;
+        size_t tombstones = 0;       // deleted rows still taking up space in table2D
+        size_t active_snapshots = 0;
+        uint64_t version = 0;        // see Snapshot::version
     };
-    struct greater {
-        private:
-            size_t index_;
-            TableEntry entry_;
-        public:
-            greater(size_t index, const TableEntry &entry): index_(index), entry_(entry){};
-            bool operator()(const std::vector<TableEntry> &table_entry){
-                return table_entry[index_] > entry_;
-            }
-            operator bool() const{return true;}
+    std::unique_ptr<Versions> versions = std::make_unique<Versions>();
+    // PRINT output by normalized query, for the version of the table it was printed from; see ResultCache.h
+    static constexpr size_t PRINT_CACHE_BYTES = 4 << 20;
+    std::unique_ptr<ResultCache> print_cache = std::make_unique<ResultCache>(PRINT_CACHE_BYTES);
+    // GENERATE ... BACKGROUND and LAZY build the index without holding latch (see build_index_aside); until it's
+    // swapped in, WHEREs use whatever index was there before or scan. The three below are guarded by index_latch
+    std::optional<DeferredIndex> deferred_index; // LAZY's, built by the first WHERE it can serve
+    uint64_t index_generation = 0; // bumped by every GENERATE; a build started in an older one is thrown away
+    size_t indexed_rows = 0; // rows index_rows() has seen, where a build off to the side catches up to
+    // adaptive mode's cracker copies, by column, made by the first range term on each; readers crack them
+    // as they go, so they have a mutex of their own. Garbage collection renumbers rows and drops them
+    struct Crackers {
+        std::mutex mutex;
+        std::map<size_t, CrackerColumn> columns;
     };
-    
+    std::unique_ptr<Crackers> crackers = std::make_unique<Crackers>();
+    JoiningThread index_builder; // BACKGROUND's; declared last so it's joined before anything it uses goes away
+
+    Snapshot acquire_snapshot(); // registers a reader, rows it can see won't move until release_snapshot()
+    void release_snapshot();
+    Snapshot current_snapshot() const; // writer's view, the caller holds latch
+    void collect_garbage(); // purges deleted rows and rebuilds the index once no snapshot is active; the caller holds latch
+
+    // the tables actually holding rows: the partitions, or just this one. Commands work part by part,
+    // with snapshots and results indexed the same way
+    bool partitioned() const { return !partitions.empty(); }
+    size_t num_parts() const { return partitioned() ? partitions.size() : 1; }
+    Table& part(size_t p) { return partitioned() ? partitions[p] : *this; }
+    const Table& part(size_t p) const { return partitioned() ? partitions[p] : *this; }
+    size_t partition_of(const TableEntry& key) const { return std::hash<TableEntry>{}(key) % partitions.size(); }
+    // a writer holding latch also needs every partition's, or their garbage collection could move rows under it
+    std::vector<WriteLock> lock_partitions();
+    std::vector<Snapshot> acquire_snapshots(); // acquire_snapshot() on every part, all as of the same write
+    void release_snapshots();
+    size_t live_rows() const; // the caller holds latch
+    // index of the column called name, columnNames.size() if there isn't one
+    size_t column_index(const std::string& name) const {
+        auto it = column_ids.find(name);
+        return (it == column_ids.end()) ? columnNames.size() : it->second;
+    }
 
-    void insert();
+    void insert(std::istream& is, std::ostream& os);
+        void read_row(std::istream& is, std::vector<TableEntry>& row) const;
+        void index_rows(size_t first, size_t last); // adds rows [first, last) to the generated index
+        void publish_rows(size_t count); // makes the last count rows visible to new snapshots
     // ERROR(1) <tablename> is not the name of a table in the database
-    void print(); // different in quiet mode
-        void print_rows_helper(size_t print_compare_column_index, char op, const TableEntry& value, std::vector<size_t>& columns_to_print);
+    void print(std::istream& is, std::ostream& os, const std::vector<Snapshot>& snaps); // different in quiet mode
+        void print_rows_helper(const WhereClause& where, const OrderBy& order, std::vector<size_t>& columns_to_print, const std::vector<Snapshot>& snaps, std::ostream& os);
+        bool parse_order(std::istream& is, OrderBy& order, std::ostream& os) const;
+        std::string print_cache_key(const std::vector<size_t>& columns_to_print, const WhereClause& where, const OrderBy& order) const;
+        // puts rows into ORDER BY order and cuts them to LIMIT; an empty where means every row
+        void order_rows(std::vector<size_t>& rows, bool all_rows, const OrderBy& order, const Snapshot& snap) const;
     //ERROR(1) <tablename> is not the name of a table in the database
     //ERROR(2) <colname> is not the name of a column in the table specified by <tablename>
     //ERROR(3) One (or more) of the <print_colname>s are not the name of a column in the table specified by <tablename> (only print the name of the first such column encountered)
-    void delete_rows();
+    void delete_rows(std::istream& is, std::ostream& os);
+    // ERROR(1) <tablename> is not the name of a table in the database
+        void delete_rows_helper(const WhereClause& where, std::ostream& os);
+        size_t kill_rows(const WhereClause& where); // stamps the matching rows with the next commit timestamp
+        void publish_deletes(size_t count); // moves to that timestamp, so new snapshots stop seeing them
+    // ERROR(2) <colname> is not the name of a column in the table specified by <tablename>
+    // GENERATE FOR <tablename> <type> INDEX ON <colname> [BACKGROUND|LAZY]
+    void generate(std::istream& is, std::ostream& os);
+        size_t build_index(IndexType type, size_t column_idx); // returns the distinct live keys
+        void start_index_build(IndexType type, size_t column_idx); // BACKGROUND
+        void defer_index(IndexType type, size_t column_idx); // LAZY
+        // the caller holds a snapshot of this part or latch, either keeps garbage collection from renumbering rows
+        void build_index_aside(IndexType type, size_t column_idx, uint64_t generation);
+        void install_index(WriteLock& index_writer, IndexBuild& fresh); // unlocks index_writer
+        void live_index_keys(std::unordered_set<TableEntry>& keys) const;
+    void group(std::istream& is, std::ostream& os, const std::vector<Snapshot>& snaps);
+        void group_rows(const WhereClause& where, bool all_rows, size_t group_col, const std::vector<Aggregate>& aggregates,
+                bool avg_as_sum, const Snapshot& snap, GroupResult& out) const;
+    MemoryUsage memory_usage() const;
+    RowStore::Stats slab_stats() const;
+    void compact(); // hands back slack: spare hash buckets, row list capacity, slab directory
+    void compact_if_slack(); // compact() once slack outweighs what's actually stored
     // ERROR(1) <tablename> is not the name of a table in the database
-        void delete_rows_helper(size_t delete_column_index, char op, const TableEntry& value);
     // ERROR(2) <colname> is not the name of a column in the table specified by <tablename>
-    void generate();
+    // ERROR(3) <colname> is not numeric but was given to SUM, MIN, MAX or AVG
+
+    //WHERE clause parsing and evaluation, shared by PRINT and DELETE
+    //evaluation reads the index: readers hold index_latch shared around it, writers already hold latch
+    // reads <pred> { AND|OR <pred> } off is, leaving anything after the last term (e.g. ORDER BY) unread
+    bool parse_where(std::istream& is, const std::string& command_name, WhereClause& where, std::ostream& os) const;
+    // builds a LAZY index in every part once a clause it can serve comes along; the caller holds snapshots or latch
+    void use_deferred_index(const WhereClause& where);
+    // batch mode's base tables: BACKGROUND builds finished and LAZY indexes built now, cracking off, so reading
+    // never changes the table and every session sees it the same way
+    void settle();
+    TableEntry read_value(std::istream& is, EntryType type) const;
+    // rows matching the clause; a single AND group comes back in the order of the index that drove it
+    std::vector<size_t> select_rows(const WhereClause& where, bool fuzzy_double_equal, const Snapshot& snap) const;
+    std::vector<size_t> select_conjunction(const std::vector<Predicate>& conjunction, bool fuzzy_double_equal, const Snapshot& snap) const;
+    // keeps the rows satisfying pred, or with scan_blocks finds them among the visible rows of every block not marked NONE;
+    // uses a kernel built for the column's type and pred's op
+    void apply_predicate(const Predicate& pred, bool fuzzy_double_equal, const std::vector<ZoneMatch>* scan_blocks, const Snapshot& snap, std::vector<size_t>& rows) const;
+    // zone map verdict per block for scanning with conjunction[scan_term]; the other terms can only rule blocks out
+    std::vector<ZoneMatch> scan_blocks(const std::vector<Predicate>& conjunction, size_t scan_term, bool fuzzy_double_equal, const Snapshot& snap) const;
+    // number of rows the generated index would hand back for pred, or SIZE_MAX if it can't answer pred
+    size_t index_estimate(const Predicate& pred) const;
+    void index_lookup(const Predicate& pred, const Snapshot& snap, std::vector<size_t>& rows) const;
+    // adaptive mode: rows matching a <, > or BETWEEN term on a non-string column, in table order, off its cracker
+    void crack_lookup(const Predicate& pred, const Snapshot& snap, std::vector<size_t>& rows) const;
+    // rows matching pred counted off a bitmap index with popcounts, without visiting them; nullopt if there's no such index
+    std::optional<size_t> bitmap_count(const Predicate& pred, const Snapshot& snap) const;
+    size_t predicate_cost(const Predicate& pred) const;
     
 };
 
+// a reader's registered snapshots of one table for as long as it's in scope
+struct SnapshotGuard {
+    Table& table;
+    std::vector<Snapshot> snaps; // snaps[p] is for table.part(p)
+
+    explicit SnapshotGuard(Table& table_in) : table(table_in), snaps(table_in.acquire_snapshots()) {}
+    SnapshotGuard(const SnapshotGuard&) = delete;
+    SnapshotGuard& operator=(const SnapshotGuard&) = delete;
+    ~SnapshotGuard() { table.release_snapshots(); }
+};
+
+// goes in front of a JOIN's hash maps: a Bloom filter over their keys, built once there are enough of them
+// for the maps to miss the caches, and dropped once it turns out most probes find a partner anyway
+struct ProbeFilter {
+    static constexpr size_t MIN_KEYS = 1 << 14;
+    static constexpr size_t SAMPLE_PROBES = 4096;
+
+    std::optional<BloomFilter> bloom;
+    size_t probes = 0;
+    size_t passed = 0;
+
+    explicit ProbeFilter(size_t num_keys){
+        if (num_keys >= MIN_KEYS){
+            bloom.emplace(num_keys);
+        }
+    }
+    bool active() const { return bloom.has_value(); }
+    void insert(const TableEntry& key){ bloom->insert(std::hash<TableEntry>{}(key)); }
+    // false only if key is in none of the maps
+    bool may_match(const TableEntry& key){
+        if (!bloom){
+            return true;
+        }
+        bool pass = bloom->may_contain(std::hash<TableEntry>{}(key));
+        passed += pass;
+        if (++probes == SAMPLE_PROBES && passed * 2 > probes){
+            bloom.reset();
+        }
+        return pass;
+    }
+};
+
+// how JOIN brings in table k + 1 of its list: its right_col equals left_col of the earlier table left_table
+struct JoinStep {
+    size_t left_table;
+    size_t left_col;
+    size_t right_col;
+};
+
+// one row of one part of a table, what a multi-way JOIN passes from stage to stage
+struct RowRef {
+    const RowStore* rows;
+    size_t row;
+    const TableEntry& cell(size_t col) const { return (*rows)[row][col]; }
+};
+
+// one part of a table as a reader sees it
+struct TablePart {
+    const Table* table;
+    const Snapshot* snap;
+};
+
+// a table as a script sees it while being read ahead: enough to know where each command ends
+struct ScriptTable {
+    std::vector<std::string> names;
+    std::vector<std::string> types;
+};
+
+// one command cut off a script, with the tables it reads and writes
+struct ScriptCommand {
+    std::string cmd;
+    std::string text; // everything the command's handler reads after cmd
+    std::vector<std::string> reads;
+    std::vector<std::string> writes;
+    bool barrier = false; // touches every table
+};
+
 class SillyQL {
     private:
     bool quietMode = false;
+    bool adaptiveMode = false; // -a: see Table::adaptive
+    bool packedScans = false; // -p: full slabs keep packed scan copies of their numeric columns, on top of the cells
+    std::string dataDir; // -d: tables keep their rows in memory mapped files here
+    size_t store_serial = 0; // -d: numbers the files, so no table name ever ends up in a path
+    std::string server_path; // -s: listen here instead of reading cin
+    std::string client_path; // -c: talk to a server listening here
+    std::string batch_dir; // -b: replay the script files named after the options, each into its own output file here
+    std::vector<std::string> batch_scripts;
+    std::string base_script; // -B: tables made by this script once, readable by every batch script
+    size_t batch_jobs = 0; // -j: scripts replayed at once, 0 for one per core
     std::unordered_map<std::string, Table> DBmap;
+    // batch mode: the tables of the base script, shared by every session. They're settled once the script is done,
+    // so sessions can't build an index or crack a column in them; only their print caches fill up
+    std::unordered_map<std::string, Table>* base_tables = nullptr;
+    // CREATE/REMOVE hold it alone, every other command shares it so its tables can't disappear
+    std::shared_mutex catalog_latch;
     
     public:
     void get_options(int argc, char* argv[]);
-    void read_input();
+    int run(); // whichever of stdin, server, client or batch mode the options asked for
+    // false if the input ran out before a QUIT
+    bool read_input(std::istream& is, std::ostream& os);
+    // redirected input: reads commands ahead and runs the ones on unrelated tables concurrently, output in script order
+    void run_script(std::istream& is, std::ostream& os);
+    void serve();
+    // one client's session on the shared database, runs on its own thread
+    void serve_client(int client_fd);
+    // batch mode: every script in a fresh session of its own, as many at once as there are jobs
+    int run_batch();
+    // the table a command reads: this session's own, or failing that a base table
+    Table* find_table(const std::string& name);
+    // whether name is a base table, which this session can read but never change
+    bool is_base_table(const std::string& name) const;
     //database commands
-    void create();
+    void create(std::istream& is, std::ostream& os);
     // ERROR(1) A table named <tablename> already exists in the database
     void quit();
     // ERROR(1) Every interactive session or redirected input file should end with a QUIT command.
-    void comment(); 
-    void remove();
+    void comment(std::istream& is);
+    void remove(std::istream& is, std::ostream& os);
     // ERROR(1) Possible Error: <tablename> is not the name of a table in the database
-    void join(const Table& table1, const Table& table2);
+    void join(const std::vector<Table*>& tables, const std::vector<const std::vector<Snapshot>*>& snaps, std::istream& is, std::ostream& os);
     //ERROR(1) <tablenameX> is not the name of a table in the database
     //ERROR(2) One (or more) of the <colname>s or <print_colname>s are not the name of a column in the table specified by <tablenameX> (only print the name of the first such column encountered)
-    void generate_col_idx(const Table& table, size_t column_idx, std::unordered_map<TableEntry, std::vector<size_t>>& umap);
-    void handle_command(std::string& command);
+    //ERROR(3) a table number that isn't one of the tables joined so far
+    // JOIN with FILTERs or more than two tables: each table's rows are filtered on their own, then joined
+    // in as a chain of hash joins over row references; prints the rows and returns how many
+    size_t join_chain(const std::vector<Table*>& tables, const std::vector<const std::vector<Snapshot>*>& snaps,
+            const std::vector<JoinStep>& steps, const std::vector<WhereClause>& filters,
+            const std::vector<std::pair<int, size_t>>& cols_ov, std::ostream& os);
+    void generate_col_idx(const Table& table, const Snapshot& snap, size_t column_idx, ProbeTable& keys);
+    // prints the pairs from joining parts side1 on col1 to parts side2 on col2, returns how many
+    size_t join_rows(const std::vector<TablePart>& side1, size_t col1, const std::vector<TablePart>& side2, size_t col2,
+            const std::vector<std::pair<int, size_t>>& cols_ov, std::ostream& os);
+    // quiet mode JOIN: number of matching pairs without visiting any of them
+    size_t join_count(const std::vector<TablePart>& side1, size_t col1, const std::vector<TablePart>& side2, size_t col2);
+    void handle_command(std::string& command, std::istream& is, std::ostream& os);
+    void memory(std::istream& is, std::ostream& os);
+    // ERROR(1) <tablename> is not the name of a table in the database
+    void compact(std::istream& is, std::ostream& os);
+    // ERROR(1) <tablename> is not the name of a table in the database
 };
 
+// whether the line goes on with a word starting with one of firsts, like PARTITION after CREATE's column
+// names; only blanks are consumed
+static bool at_clause(std::istream& is, const std::string& firsts){
+    while (is.peek() == ' ' || is.peek() == '\t'){
+        is.get();
+    }
+    int next = is.peek();
+    return next != std::char_traits<char>::eof() && firsts.find(static_cast<char>(next)) != std::string::npos;
+}
+
+// JOIN's fixed words are only placeholders to its old two table form, so they come in any case
+static bool is_keyword(const std::string& word, const std::string& keyword){
+    return std::equal(word.begin(), word.end(), keyword.begin(), keyword.end(), [](char a, char b){
+        return std::toupper(static_cast<unsigned char>(a)) == b;
+    });
+}
+
+// <colname> out of HASH(<colname>), or the token as is
+static std::string partition_column(const std::string& token){
+    if (token.size() > 6 && token.compare(0, 5, "HASH(") == 0 && token.back() == ')'){
+        return token.substr(5, token.size() - 6);
+    }
+    return token;
+}
+
+// reads exactly what handle_command will read for command.cmd, error paths included, so that
+// replaying command.text from a string runs the command the same way; tables is the catalog
+// as of this point in the script
+static void cut_command(std::istream& is, ScriptCommand& command, std::unordered_map<std::string, ScriptTable>& tables){
+    auto word = [&](){
+        std::string w;
+        is >> w;
+        command.text += ' ' + w;
+        return w;
+    };
+    auto number = [&](){
+        size_t n = 0;
+        std::istringstream(word()) >> n;
+        return n;
+    };
+    auto rest_of_line = [&](){
+        std::string line;
+        std::getline(is, line);
+        command.text += line + '\n';
+    };
+    auto column = [](const ScriptTable& table, const std::string& name){
+        auto it = std::find(table.names.begin(), table.names.end(), name);
+        return (it == table.names.end()) ? SIZE_MAX : static_cast<size_t>(std::distance(table.names.begin(), it));
+    };
+
+    const std::string& cmd = command.cmd;
+    if ((cmd[0] == 'C' && cmd[1] == 'O') || cmd[0] == 'M'){
+        rest_of_line();
+        std::istringstream names(command.text);
+        std::string name;
+        auto& tables_used = (cmd[0] == 'M') ? command.reads : command.writes;
+        while (names >> name){
+            tables_used.push_back(name);
+        }
+        command.barrier = tables_used.empty(); // no names means every table
+    } else if (cmd[0] == 'C'){
+        std::string name = word();
+        command.writes.push_back(name);
+        if (tables.count(name)){
+            rest_of_line();
+            return;
+        }
+        ScriptTable table;
+        size_t N = number();
+        for (size_t i = 0; i < N; ++i){
+            table.types.push_back(word());
+        }
+        for (size_t i = 0; i < N; ++i){
+            table.names.push_back(word());
+        }
+        if (at_clause(is, "P")){
+            word(); // PARTITION
+            word(); // BY
+            bool valid = column(table, partition_column(word())) != SIZE_MAX; // HASH(<colname>)
+            if (number() == 0 || !valid){
+                return; // CREATE fails, the table never exists
+            }
+        }
+        tables.emplace(name, std::move(table));
+    } else if (cmd[0] == 'R'){
+        command.writes.push_back(word());
+        tables.erase(command.writes.back());
+    } else if (cmd[0] == 'I'){
+        word(); // INTO
+        std::string name = word();
+        command.writes.push_back(name);
+        auto it = tables.find(name);
+        if (it == tables.end()){
+            rest_of_line();
+            return;
+        }
+        size_t N = number();
+        word(); // ROWS
+        command.text += '\n';
+        for (size_t i = 0; i < N; ++i){
+            for (size_t c = 0; c < it->second.names.size(); ++c){
+                word();
+            }
+            command.text += '\n';
+        }
+    } else if (cmd[0] == 'P' || cmd[0] == 'D' || cmd[0] == 'G'){
+        word(); // FROM/FOR
+        std::string name = word();
+        bool reads = (cmd[0] == 'P' || cmd[1] == 'R');
+        (reads ? command.reads : command.writes).push_back(name);
+        auto it = tables.find(name);
+        if (it == tables.end()){
+            rest_of_line();
+            return;
+        }
+        const ScriptTable& table = it->second;
+        if (cmd[0] == 'P'){
+            size_t N = number();
+            for (size_t i = 0; i < N; ++i){
+                if (column(table, word()) == SIZE_MAX){
+                    rest_of_line();
+                    return;
+                }
+            }
+        } else if (cmd[0] == 'G' && cmd[1] == 'R'){
+            word(); // BY
+            if (column(table, word()) == SIZE_MAX){
+                rest_of_line();
+                return;
+            }
+            size_t N = number();
+            for (size_t i = 0; i < N; ++i){
+                std::string func = word();
+                size_t col = column(table, word());
+                bool known = (func == "COUNT" || func == "SUM" || func == "MIN" || func == "MAX" || func == "AVG");
+                bool numeric = col < table.types.size() && (table.types[col] == "int" || table.types[col] == "double");
+                if (col == SIZE_MAX || !known || (func != "COUNT" && !numeric)){
+                    rest_of_line();
+                    return;
+                }
+            }
+        } else if (cmd[0] == 'G'){
+            word(); // hash/bst/bitmap
+            word(); // INDEX
+            word(); // ON
+            if (column(table, word()) == SIZE_MAX){
+                rest_of_line();
+            } else if (at_clause(is, "BL")){
+                word(); // BACKGROUND/LAZY
+            }
+            return;
+        }
+        word(); // WHERE/ALL
+        rest_of_line();
+    } else if (cmd[0] == 'J'){
+        std::vector<std::string> names{word()};
+        while (!is_keyword(word(), "WHERE") && is){ // AND <tablename>, until WHERE
+            names.push_back(word());
+        }
+        command.reads = names;
+        std::vector<const ScriptTable*> joined;
+        for (const std::string& name : names){
+            auto it = tables.find(name);
+            if (it == tables.end()){
+                rest_of_line();
+                return;
+            }
+            joined.push_back(&it->second);
+        }
+        //<col> <i>, i from 1 to limit
+        auto numbered_column = [&](size_t limit){
+            std::string name = word();
+            size_t num = number();
+            return num >= 1 && num <= limit && column(*joined[num - 1], name) != SIZE_MAX;
+        };
+        bool found = (column(*joined[0], word()) != SIZE_MAX);
+        for (size_t k = 1; k < joined.size() && found; ++k){
+            if (k > 1){
+                word(); // AND
+                found = numbered_column(k);
+                if (!found){
+                    break;
+                }
+            }
+            word(); // =
+            found = (column(*joined[k], word()) != SIZE_MAX);
+        }
+        if (found){
+            word(); // AND
+            word(); // PRINT
+            size_t N = number();
+            for (size_t i = 0; i < N && found; ++i){
+                found = numbered_column(joined.size());
+            }
+        }
+        if (!found || at_clause(is, "F")){
+            rest_of_line(); // FILTERs run to the end of the line
+        }
+    } else if (cmd[0] != 'Q'){
+        rest_of_line(); // comment, or not a command
+    }
+}
+
  //unordered map from table name to the table class (that I create)
     void SillyQL::get_options(int argc, char* argv[]){
         int optionIdx = 0, option = 0;
@@ -148,10 +715,18 @@ class SillyQL {
         struct option longOpts [] = {
             {"help", no_argument, nullptr, 'h'},
             {"quiet", no_argument, nullptr, 'q'},
+            {"adaptive", no_argument, nullptr, 'a'},
+            {"packed-scans", no_argument, nullptr, 'p'},
+            {"data-dir", required_argument, nullptr, 'd'},
+            {"server", required_argument, nullptr, 's'},
+            {"connect", required_argument, nullptr, 'c'},
+            {"batch", required_argument, nullptr, 'b'},
+            {"base", required_argument, nullptr, 'B'},
+            {"jobs", required_argument, nullptr, 'j'},
             {nullptr, no_argument, nullptr, '\0'}
         };
         
-        while ((option = getopt_long(argc, argv, "hq", longOpts, &optionIdx)) != -1){
+        while ((option = getopt_long(argc, argv, "hqapd:s:c:b:B:j:", longOpts, &optionIdx)) != -1){
             switch(option){
                 case 'h':
                     std::cerr << "Help Mode\n";
@@ -162,130 +737,461 @@ class SillyQL {
                     std::cerr << "Quiet Mode\n";
                     break;
 
+                case 'a':
+                    adaptiveMode = true;
+                    break;
+
+                case 'p':
+                    packedScans = true;
+                    break;
+
+                case 'd':
+                    dataDir = optarg;
+                    break;
+
+                case 's':
+                    server_path = optarg;
+                    break;
+
+                case 'c':
+                    client_path = optarg;
+                    break;
+
+                case 'b':
+                    batch_dir = optarg;
+                    break;
+
+                case 'B':
+                    base_script = optarg;
+                    break;
+
+                case 'j':
+                    std::istringstream(optarg) >> batch_jobs;
+                    break;
+
                 default:
                     std::cerr << "Unknown option\n";
                     exit(1);
             }
         }
+        //batch mode: the scripts come after the options
+        for (int i = optind; i < argc; ++i){
+            batch_scripts.emplace_back(argv[i]);
+        }
+        if (batch_dir.empty() && (!batch_scripts.empty() || !base_script.empty())){
+            std::cerr << "Script files and --base need --batch\n";
+            exit(1);
+        }
     }//end of get_options
 
-    void SillyQL::read_input(){
+    bool SillyQL::read_input(std::istream& is, std::ostream& os){
         std::string cmd;
         do {
-            std::cout << "% ";
-            std::cin >> cmd;
-            if (std::cin.fail()) {
-                std::cerr << "Reading from cin has failed" << '\n';
-                exit(1);
+            os << "% ";
+            is >> cmd;
+            if (is.fail()) {
+                return false;
             } 
-            handle_command(cmd);
+            handle_command(cmd, is, os);
         } 
     while (cmd != "QUIT");
+        return true;
     } 
 
-       void SillyQL::handle_command(std::string& command){
-            if (command[0] == 'C'){
-                create();
+    int SillyQL::run(){
+        if (!client_path.empty()){
+            return run_client(client_path);
+        }
+        if (!server_path.empty()){
+            serve();
+            return 0;
+        }
+        if (!batch_dir.empty()){
+            return run_batch();
+        }
+        //someone typing gets the prompt before each command; a script gets scheduled
+        if (isatty(STDIN_FILENO)){
+            if (!read_input(std::cin, std::cout)){
+                std::cerr << "Reading from cin has failed" << '\n';
+                exit(1);
+            }
+        } else {
+            run_script(std::cin, std::cout);
+        }
+        return 0;
+    }
+
+    void SillyQL::run_script(std::istream& is, std::ostream& os){
+        bool input_failed = false;
+        //cin flushes cout before every read, but here os belongs to the scheduler's threads
+        std::ostream* tied = is.tie(nullptr);
+        {
+            CommandScheduler scheduler(os);
+            std::unordered_map<std::string, ScriptTable> script_tables;
+            ScriptCommand command;
+            do {
+                command = ScriptCommand{};
+                if (!(is >> command.cmd)){
+                    input_failed = true;
+                    break;
+                }
+                cut_command(is, command, script_tables);
+                //the command's line ends where it did in the script, for handlers that peek or read past their last word
+                if (command.text.empty() || command.text.back() != '\n'){
+                    command.text += '\n';
+                }
+                bool whole = !is.fail(); // false if the script ran out partway through the command
+
+                scheduler.submit(command.reads, command.writes, command.barrier, [this, whole, cmd = command.cmd, text = std::move(command.text)](std::ostream& out){
+                    std::istringstream args(text);
+                    args >> std::boolalpha;
+                    out << std::boolalpha << "% ";
+                    std::string command_name = cmd;
+                    handle_command(command_name, args, out);
+                    //cut_command has to read just what the handler does; a debug build checks every command
+                    assert(!whole || (!args.fail() && (args >> std::ws).eof()));
+                });
+            } while (command.cmd != "QUIT");
+            scheduler.drain(); // a command that threw rethrows here, or from submit(), once the output before it is out
+        }
+        is.tie(tied);
+
+        if (input_failed){
+            os << "% ";
+            std::cerr << "Reading from cin has failed" << '\n';
+            exit(1);
+        }
+    }
+
+    //server mode: every connection gets a session thread over the one shared DBmap
+    void SillyQL::serve(){
+        int listen_fd = listen_unix(server_path);
+        if (listen_fd < 0){
+            std::cerr << "Could not listen on " << server_path << '\n';
+            exit(1);
+        }
+        std::cerr << "Listening on " << server_path << '\n';
+
+        while (true){
+            int client_fd = accept(listen_fd, nullptr, nullptr);
+            if (client_fd < 0){
+                if (errno == EINTR){
+                    continue;
+                }
+                std::cerr << "accept failed\n";
+                break;
+            }
+            std::thread(&SillyQL::serve_client, this, client_fd).detach();
+        }
+        close(listen_fd);
+    }
+
+    void SillyQL::serve_client(int client_fd){
+        {
+            FdStreamBuf buf(client_fd);
+            std::istream is(&buf);
+            std::ostream os(&buf);
+            is >> std::boolalpha;
+            os << std::boolalpha;
+
+            //same loop as read_input, but a client hanging up only ends its own session
+            std::string cmd;
+            do {
+                os << "% " << std::flush;
+                if (!(is >> cmd)){
+                    break;
+                }
+                handle_command(cmd, is, os);
+                os.flush();
+            } while (cmd != "QUIT");
+        }
+        close(client_fd);
+    }
+
+    // <dir>/<file name of path>, with .txt traded for ext
+    static std::string batch_file(const std::string& dir, const std::string& path, const std::string& ext){
+        std::string name = path.substr(path.find_last_of('/') + 1);
+        if (name.size() > 4 && name.compare(name.size() - 4, 4, ".txt") == 0){
+            name.resize(name.size() - 4);
+        }
+        return dir + "/" + name + ext;
+    }
+
+    //batch mode: one process replays many scripts; each gets a session of its own (the same options, its own
+    //tables, its own data directory under -d) and its own output file, and the sessions run on a pool of jobs
+    int SillyQL::run_batch(){
+        if (mkdir(batch_dir.c_str(), 0777) != 0 && errno != EEXIST){
+            std::cerr << "Could not make " << batch_dir << '\n';
+            return 1;
+        }
+        std::unordered_set<std::string> outputs;
+        for (const std::string& script : batch_scripts){
+            if (!outputs.insert(batch_file(batch_dir, script, ".out")).second){
+                std::cerr << "Two scripts would both write " << batch_file(batch_dir, script, ".out") << '\n';
+                return 1;
+            }
+        }
+
+        using Clock = std::chrono::steady_clock;
+        auto millis = [](Clock::duration d){
+            return std::chrono::duration<double, std::milli>(d).count();
+        };
+        // replays path into session, returns how it went
+        auto replay = [&](SillyQL& session, const std::string& path){
+            std::ifstream is(path);
+            if (!is){
+                return std::string("could not be read");
+            }
+            std::ofstream os(batch_file(batch_dir, path, ".out"));
+            if (!os){
+                return std::string("output could not be written");
+            }
+            is >> std::boolalpha;
+            os << std::boolalpha;
+            return session.read_input(is, os) ? std::string("ok") : std::string("ended without QUIT");
+        };
+        // a fresh session with this one's options
+        auto configure = [&](SillyQL& session, const std::string& path){
+            session.quietMode = quietMode;
+            session.adaptiveMode = adaptiveMode;
+            session.packedScans = packedScans;
+            if (!dataDir.empty()){
+                session.dataDir = batch_file(dataDir, path, "");
+                mkdir(session.dataDir.c_str(), 0777);
+            }
+        };
+
+        auto batch_start = Clock::now();
+        //the base script runs first and alone, and then its tables only ever get read
+        std::unique_ptr<SillyQL> base;
+        if (!base_script.empty()){
+            base = std::make_unique<SillyQL>();
+            configure(*base, base_script);
+            auto start = Clock::now();
+            std::string status = replay(*base, base_script);
+            std::cout << base_script << " (base): " << status << ", " << millis(Clock::now() - start) << " ms\n";
+            if (status != "ok"){
+                return 1;
+            }
+            for (auto& entry : base->DBmap){
+                entry.second.settle();
+            }
+        }
+
+        struct Result {
+            std::string status;
+            Clock::duration time{};
+        };
+        std::vector<Result> results(batch_scripts.size());
+        size_t jobs = batch_jobs ? batch_jobs : std::max<size_t>(1, std::thread::hardware_concurrency());
+        jobs = std::max<size_t>(1, std::min(jobs, batch_scripts.size()));
+        std::atomic<size_t> next{0};
+        run_parts(jobs, [&](size_t){
+            for (size_t i = next++; i < batch_scripts.size(); i = next++){
+                auto start = Clock::now();
+                {
+                    SillyQL session;
+                    configure(session, batch_scripts[i]);
+                    session.base_tables = base ? &base->DBmap : nullptr;
+                    results[i].status = replay(session, batch_scripts[i]);
+                } // its tables go away on this job too
+                results[i].time = Clock::now() - start;
+            }
+        });
+
+        //summary, in the order the scripts were named
+        Clock::duration script_time{};
+        size_t failed = 0;
+        for (size_t i = 0; i < batch_scripts.size(); ++i){
+            std::cout << batch_scripts[i] << ": " << results[i].status << ", " << millis(results[i].time) << " ms\n";
+            script_time += results[i].time;
+            failed += (results[i].status != "ok");
+        }
+        std::cout << "Replayed " << batch_scripts.size() << " scripts (" << failed << " failed) on " << jobs << (jobs == 1 ? " job" : " jobs") << " in "
+                  << millis(Clock::now() - batch_start) << " ms, " << millis(script_time) << " ms of script time\n";
+        return failed ? 1 : 0;
+    }
+
+    Table* SillyQL::find_table(const std::string& name){
+        auto it = DBmap.find(name);
+        if (it != DBmap.end()){
+            return &it->second;
+        }
+        if (base_tables){
+            auto base_it = base_tables->find(name);
+            if (base_it != base_tables->end()){
+                return &base_it->second;
+            }
+        }
+        return nullptr;
+    }
+
+    bool SillyQL::is_base_table(const std::string& name) const{
+        return base_tables && base_tables->count(name);
+    }
+
+       void SillyQL::handle_command(std::string& command, std::istream& is, std::ostream& os){
+            //CREATE and REMOVE change which tables exist, everything else just needs them to stay put
+            bool changes_catalog = (command[0] == 'C' && command[1] != 'O') || command[0] == 'R';
+            WriteLock catalog_writer(catalog_latch, std::defer_lock);
+            ReadLock catalog_reader(catalog_latch, std::defer_lock);
+            if (changes_catalog){
+                catalog_writer.lock();
+            } else {
+                catalog_reader.lock();
+            }
+
+            if (command[0] == 'C' && command[1] == 'O'){
+                compact(is, os);
+            } else if (command[0] == 'C'){
+                create(is, os);
             } else if (command[0] == 'R'){
-                remove();
+                remove(is, os);
             } else if (command[0] == '#'){
-                comment();
+                comment(is);
             } else if (command[0] == 'I'){
-                std::cin >> command; // "INTO"
-                std::cin >> command; // <tablename>
+                is >> command; // "INTO"
+                is >> command; // <tablename>
                 auto it = DBmap.find(command);
-                if (it == DBmap.end()){
-                    std::cout << "Error during INSERT: " << command << " does not name a table in the database\n";
-                    std::getline(std::cin, command);
+                if (is_base_table(command)){
+                    os << "Error during INSERT: " << command << " is a read-only base table\n";
+                    size_t N = 0;
+                    is >> N >> command; // <N> ROWS
+                    for (size_t i = 0; i <= N; ++i){
+                        std::getline(is, command); // the rest of this line, then each row's
+                    }
+                } else if (it == DBmap.end()){
+                    os << "Error during INSERT: " << command << " does not name a table in the database\n";
+                    std::getline(is, command);
                 } else {
-                    DBmap[command].insert();
+                    WriteLock writer(*it->second.latch);
+                    it->second.insert(is, os);
                 }
             } else if (command[0] == 'P'){
-                std::cin >> command; // "FROM"
-                std::cin >> command; //<tablename>
-                auto it = DBmap.find(command);
-                if (it == DBmap.end()){
-                    std::cout << "Error during PRINT: " << command << " does not name a table in the database\n";
-                    std::getline(std::cin, command);
+                is >> command; // "FROM"
+                is >> command; //<tablename>
+                Table* table = find_table(command);
+                if (!table){
+                    os << "Error during PRINT: " << command << " does not name a table in the database\n";
+                    std::getline(is, command);
                 } else {
-                    DBmap[command].print();
+                    SnapshotGuard reader(*table);
+                    table->print(is, os, reader.snaps);
                 }
             } else if (command[0] == 'D'){
-                std::cin >> command;// "FROM"
-                std::cin >> command; //<tablename>
+                is >> command;// "FROM"
+                is >> command; //<tablename>
                 auto it = DBmap.find(command);
-                if (it == DBmap.end()){
-                    std::cout << "Error during DELETE: " << command << " does not name a table in the database\n";
-                    std::getline(std::cin, command);
+                if (is_base_table(command)){
+                    os << "Error during DELETE: " << command << " is a read-only base table\n";
+                    std::getline(is, command);
+                } else if (it == DBmap.end()){
+                    os << "Error during DELETE: " << command << " does not name a table in the database\n";
+                    std::getline(is, command);
                 } else {
-                    DBmap[command].delete_rows();
+                    WriteLock writer(*it->second.latch);
+                    it->second.delete_rows(is, os);
                 }
             } else if (command[0] == 'J'){
-                std::string name_of_table1;
-                std::string name_of_table2;
-
-                std::cin >> name_of_table1; //Name of Table 1
-                auto it_tb1 = DBmap.find(name_of_table1);
-                std::cin >> command; // "AND"
-                std::cin >> name_of_table2; // Name of Table 2
-                auto it_tb2 = DBmap.find(name_of_table2);
-
-
-                if (it_tb1 == DBmap.end()){
-                    std::cout << "Error during JOIN: " << name_of_table1 << " does not name a table in the database\n";
-                    std::getline(std::cin, command);
-                } else if (it_tb2 == DBmap.end()){
-                    std::cout << "Error during JOIN: " << name_of_table2 << " does not name a table in the database\n";
-                    std::getline(std::cin, command);
+                //<tablename1> AND <tablename2> { AND <tablenameK> } WHERE
+                std::vector<std::string> names(1);
+                is >> names[0];
+                while (is >> command && !is_keyword(command, "WHERE")){ // AND
+                    names.emplace_back();
+                    is >> names.back();
+                }
+                std::vector<Table*> tables;
+                for (const std::string& name : names){
+                    Table* table = find_table(name);
+                    if (!table){
+                        os << "Error during JOIN: " << name << " does not name a table in the database\n";
+                        std::getline(is, command);
+                        break;
+                    }
+                    tables.push_back(table);
+                }
+                if (tables.size() == names.size()){
+                    //a table named twice (a self-join) reads every mention from the one snapshot
+                    std::deque<SnapshotGuard> readers;
+                    std::vector<const std::vector<Snapshot>*> snaps;
+                    for (size_t k = 0; k < tables.size(); ++k){
+                        size_t first = static_cast<size_t>(std::find(tables.begin(), tables.end(), tables[k]) - tables.begin());
+                        if (first == k){
+                            snaps.push_back(&readers.emplace_back(*tables[k]).snaps);
+                        } else {
+                            snaps.push_back(snaps[first]);
+                        }
+                    }
+                    join(tables, snaps, is, os);
+                }
+            } else if (command[0] == 'G' && command[1] == 'R'){
+                is >> command; // "FROM"
+                is >> command; // <tablename>
+                Table* table = find_table(command);
+                if (!table){
+                    os << "Error during GROUP: " << command << " does not name a table in the database\n";
+                    std::getline(is, command);
                 } else {
-                    join(DBmap[name_of_table1], DBmap[name_of_table2]);
+                    SnapshotGuard reader(*table);
+                    table->group(is, os, reader.snaps);
                 }
             } else if (command[0] == 'G'){
                 std::string table_name;
-                std::cin >> table_name; // FOR
-                std::cin >> table_name; // <tablename>
+                is >> table_name; // FOR
+                is >> table_name; // <tablename>
                 auto it = DBmap.find(table_name);
-                if (it == DBmap.end()){
-                    std::cout << "Error during GENERATE: " << table_name << " does not name a table in the database\n";
-                    std::getline(std::cin, command);
+                if (is_base_table(table_name)){
+                    os << "Error during GENERATE: " << table_name << " is a read-only base table\n";
+                    std::getline(is, command);
+                } else if (it == DBmap.end()){
+                    os << "Error during GENERATE: " << table_name << " does not name a table in the database\n";
+                    std::getline(is, command);
                 } else {
-                    DBmap[table_name].generate();
+                    WriteLock writer(*it->second.latch);
+                    it->second.generate(is, os);
                 }
+            } else if (command[0] == 'M'){
+                memory(is, os);
             } else if (command[0] == 'Q'){
-                std::cout << "Thanks for being silly!\n";
+                os << "Thanks for being silly!\n";
             } else {
-                std::cout << "Error: unrecognized command\n";
-                std::getline(std::cin, command);
+                os << "Error: unrecognized command\n";
+                std::getline(is, command);
             }
     }// end of read input
 
 
     // DB commands
 //could be create thats causing the issue
-void SillyQL::create(){
+void SillyQL::create(std::istream& is, std::ostream& os){
     //  std::cerr << "create\n";
     std::string input;
     std::string tableName;
-    std::cin >> tableName;
+    is >> tableName;
 
-    auto found_it = DBmap.find(tableName);
-    if (found_it != DBmap.end()){
-        std::cout << "Error during CREATE: Cannot create already existing table " << tableName << '\n';
-        std::getline(std::cin, input);
+    //one probe both checks the name and makes the table, built right where it stays; an error takes it back out
+    if (is_base_table(tableName)){
+        os << "Error during CREATE: Cannot create already existing table " << tableName << '\n';
+        std::getline(is, input);
         return;
     }
-
-    Table t;
+    auto [table_it, inserted] = DBmap.try_emplace(tableName);
+    if (!inserted){
+        os << "Error during CREATE: Cannot create already existing table " << tableName << '\n';
+        std::getline(is, input);
+        return;
+    }
+    Table& t = table_it->second;
     t.table_name = tableName;
 
     size_t N;
-    std::cin >> N;
+    is >> N;
 
     t.columnNames.reserve(N);
     t.columnTypes.reserve(N);
 
     for (size_t i = 0; i < N; ++i){
-        std::cin >> input;
+        is >> input;
 
         if (input == "string"){
             t.columnTypes.push_back(EntryType::String);
@@ -299,77 +1205,347 @@ void SillyQL::create(){
     }
 
     for (size_t i = 0; i < N; ++i){
-            std::cin >> input;
+            is >> input;
             t.columnNames.push_back(input);
+            t.column_ids.try_emplace(input, i);
+    }
+
+    //optional PARTITION BY HASH(<colname>) <N>, on the same line
+    size_t num_partitions = 0;
+    if (at_clause(is, "P")){
+        std::string hash_col;
+        is >> input >> input >> hash_col >> num_partitions; // PARTITION BY HASH(<colname>) <N>
+        hash_col = partition_column(hash_col);
+        size_t hash_idx = t.column_index(hash_col);
+        if (hash_idx == t.columnNames.size()){
+            os << "Error during CREATE: " << hash_col << " does not name a column in " << tableName << '\n';
+            DBmap.erase(table_it);
+            return;
+        }
+        if (num_partitions == 0){
+            os << "Error during CREATE: " << tableName << " needs at least one partition\n";
+            DBmap.erase(table_it);
+            return;
+        }
+        t.partition_col = hash_idx;
     }
 
     if (quietMode){
         t.quiet = true;
     }
-
-    // //assign table to key in unordered map
-    DBmap.emplace(tableName, t); // right here
+    t.adaptive = adaptiveMode;
+    //-d: rows go in files under the data directory instead of on the heap, one per store, named
+    //<pid>.<serial>.rows since a table name can be anything (a/b, .., another table's file)
+    auto make_store = [&](){
+        if (dataDir.empty()){
+            return RowStore(t.columnTypes, packedScans);
+        }
+        std::string file = std::to_string(getpid()) + "." + std::to_string(store_serial++) + ".rows";
+        return RowStore(t.columnTypes, packedScans, dataDir + "/" + file);
+    };
+    try {
+        t.table2D = make_store();
+        for (size_t p = 0; p < num_partitions; ++p){
+            Table& partition = t.partitions.emplace_back();
+            partition.table_name = tableName;
+            partition.quiet = t.quiet;
+            partition.adaptive = t.adaptive;
+            partition.columnTypes = t.columnTypes;
+            partition.columnNames = t.columnNames;
+            partition.column_ids = t.column_ids;
+            partition.table2D = make_store();
+        }
+    } catch (const std::system_error& e) {
+        os << "Error during CREATE: " << e.what() << '\n';
+        DBmap.erase(table_it);
+        return;
+    }
 
     //New table <tablename> with column(s) <colname1> <colname2> ... <colnameN> created
-    std::cout << "New table " << tableName << " with column(s) ";
+    os << "New table " << tableName << " with column(s) ";
     for (size_t i = 0; i < N; ++i){
-        std::cout << t.columnNames[i] << " ";
+        os << t.columnNames[i] << " ";
     }
-    std::cout << "created\n";
+    os << "created";
+    if (num_partitions != 0){
+        os << " with " << num_partitions << " partitions on " << t.columnNames[t.partition_col];
+    }
+    os << '\n';
 
 } // end of DB::create
 
-void SillyQL::remove() {
+void SillyQL::remove(std::istream& is, std::ostream& os) {
     std::string table_name;
-    std::cin >> table_name;
+    is >> table_name;
 
     auto it = DBmap.find(table_name);
-    if (it != DBmap.end()) {
+    if (is_base_table(table_name)) {
+        os << "Error during REMOVE: " << table_name << " is a read-only base table\n";
+    } else if (it != DBmap.end()) {
         DBmap.erase(it);
-        std::cout << "Table " << table_name << " removed\n"; 
+        os << "Table " << table_name << " removed\n"; 
     } else {
-        std::cout << "Error during REMOVE: " << table_name << " does not name a table in the database\n"; 
+        os << "Error during REMOVE: " << table_name << " does not name a table in the database\n"; 
     }
 }
 
-void SillyQL::comment(){
-    std::string line;
-    std::getline(std::cin, line);
+// names from the rest of the command line, or every table (in name order) if there are none
+static std::vector<std::string> tables_named(const std::unordered_map<std::string, Table>& DBmap, std::istream& is){
+    std::string line, name;
+    std::getline(is, line);
+    std::istringstream names(line);
 
-    //finish
-} // end of DB::comment
+    std::vector<std::string> table_names;
+    while (names >> name){
+        table_names.push_back(name);
+    }
+    if (table_names.empty()){
+        for (const auto& entry : DBmap){
+            table_names.push_back(entry.first);
+        }
+        std::sort(table_names.begin(), table_names.end());
+    }
+    return table_names;
+}
 
-void Table::insert(){
+// MEMORY [<tablename> ...]
+void SillyQL::memory(std::istream& is, std::ostream& os){
+    size_t grand_total = 0;
+    for (const std::string& name : tables_named(DBmap, is)){
+        Table* table = find_table(name);
+        if (!table){
+            os << "Error during MEMORY: " << name << " does not name a table in the database\n";
+            continue;
+        }
+        ReadLock reader(*table->latch);
+        MemoryUsage usage = table->memory_usage();
+        RowStore::Stats alloc = table->slab_stats();
+        grand_total += usage.total();
+        os << "Memory for " << name << ": data " << usage.data << " bytes, index " << usage.index
+                  << " bytes, strings " << usage.strings << " bytes, slack " << usage.slack << " bytes ("
+                  << alloc.live_slabs << " slabs live, " << alloc.slab_allocs << " allocated, "
+                  << alloc.slab_frees << " freed)\n";
+    }
+    os << "Memory total: " << grand_total << " bytes\n";
+}
+
+// COMPACT [<tablename> ...]
+void SillyQL::compact(std::istream& is, std::ostream& os){
+    for (const std::string& name : tables_named(DBmap, is)){
+        auto it = DBmap.find(name);
+        if (is_base_table(name)){
+            os << "Error during COMPACT: " << name << " is a read-only base table\n";
+            continue;
+        }
+        if (it == DBmap.end()){
+            os << "Error during COMPACT: " << name << " does not name a table in the database\n";
+            continue;
+        }
+        WriteLock writer(*it->second.latch);
+        size_t before = it->second.memory_usage().total();
+        it->second.compact();
+        os << "Compacted " << name << " from " << before << " to " << it->second.memory_usage().total() << " bytes\n";
+    }
+}
+
+void SillyQL::comment(std::istream& is){
+    std::string line;
+    std::getline(is, line);
+
+    //finish
+} // end of DB::comment
+
+// adds rows [first, last) of table2D to a generated index on col
+template <typename Index>
+static void add_postings(const RowStore& table2D, size_t col, size_t first, size_t last, Index& index){
+    for (size_t i = first; i < last; ++i){
+        index[table2D[i][col]].push_back(i);
+    }
+}
+
+Snapshot Table::acquire_snapshot(){
+    std::lock_guard<std::mutex> guard(versions->mutex);
+    ++versions->active_snapshots;
+    return Snapshot{versions->commit_ts, versions->published_rows, versions->live_rows, versions->tombstones != 0, versions->version};
+}
+
+void Table::release_snapshot(){
+    bool garbage = false;
+    {
+        std::lock_guard<std::mutex> guard(versions->mutex);
+        --versions->active_snapshots;
+        garbage = (versions->active_snapshots == 0 && versions->tombstones != 0);
+    }
+    //last reader out cleans up after DELETEs that had to leave their rows behind, unless a writer is busy
+    if (garbage && latch->try_lock()){
+        collect_garbage();
+        latch->unlock();
+    }
+}
+
+Snapshot Table::current_snapshot() const {
+    std::lock_guard<std::mutex> guard(versions->mutex);
+    return Snapshot{versions->commit_ts, versions->published_rows, versions->live_rows, versions->tombstones != 0, versions->version};
+}
+
+std::vector<WriteLock> Table::lock_partitions(){
+    std::vector<WriteLock> locks;
+    for (Table& partition : partitions){
+        locks.emplace_back(*partition.latch);
+    }
+    return locks;
+}
+
+std::vector<Snapshot> Table::acquire_snapshots(){
+    if (!partitioned()){
+        return {acquire_snapshot()};
+    }
+    std::vector<Snapshot> snaps;
+    std::lock_guard<std::mutex> guard(versions->mutex);
+    for (Table& partition : partitions){
+        snaps.push_back(partition.acquire_snapshot());
+    }
+    return snaps;
+}
+
+void Table::release_snapshots(){
+    for (size_t p = 0; p < num_parts(); ++p){
+        part(p).release_snapshot();
+    }
+}
+
+size_t Table::live_rows() const {
+    size_t live = 0;
+    for (size_t p = 0; p < num_parts(); ++p){
+        live += part(p).versions->live_rows;
+    }
+    return live;
+}
+
+void Table::collect_garbage(){
+    if (partitioned()){
+        for (Table& partition : partitions){
+            partition.collect_garbage();
+        }
+        return;
+    }
+    {
+        //holding the mutex keeps new snapshots out while rows get renumbered
+        std::lock_guard<std::mutex> guard(versions->mutex);
+        if (versions->active_snapshots != 0 || versions->tombstones == 0){
+            return;
+        }
+        table2D.purge_dead();
+        versions->tombstones = 0;
+        versions->published_rows = table2D.size();
+
+        {
+            std::lock_guard<std::mutex> crack_guard(crackers->mutex);
+            crackers->columns.clear();
+        }
+        WriteLock index_writer(*index_latch);
+        indexed_rows = table2D.size();
+        if (index_type == IndexType::HASH){
+            //regenerate Hash index
+            hashTable.clear();
+            add_postings(table2D, col_of_generated_index, 0, table2D.size(), hashTable);
+            can_use_generated_index = (hashTable.size() == 0) ? false : true;
+        } else if (index_type == IndexType::BST){
+            //regenerate Bst index
+            bst.clear();
+            add_postings(table2D, col_of_generated_index, 0, table2D.size(), bst);
+            can_use_generated_index = (bst.size() == 0) ? false : true;
+        } else if (index_type == IndexType::BITMAP){
+            //regenerate Bitmap index
+            bitmaps.clear();
+            add_postings(table2D, col_of_generated_index, 0, table2D.size(), bitmaps);
+            can_use_generated_index = (bitmaps.size() == 0) ? false : true;
+        }
+    }
+    compact_if_slack();
+}
+
+void Table::insert(std::istream& is, std::ostream& os){
     size_t N;
-    std::cin >> N;
+    is >> N;
 
     std::string junk;
-    std::cin >> junk;
+    is >> junk;
+
+    size_t first_position = live_rows(); // positions count live rows, not deleted ones waiting on a snapshot
+
+    //cells are built here, then moved into the table's slab storage
+    std::vector<TableEntry> row;
+    row.reserve(columnNames.size());
+
+    if (!partitioned()){
+        size_t curr_size = table2D.size();
+        table2D.reserve(curr_size + N); // slabs for the whole batch up front
+        for (size_t i = 0; i < N; ++i){
+            read_row(is, row);
+            table2D.push_row(row);
+        }
+        index_rows(curr_size, curr_size + N);
+        publish_rows(N);
+    } else {
+        //rows are routed by key as they're read, then every partition appends its batch on its own thread
+        size_t num_cols = columnNames.size();
+        std::vector<std::vector<TableEntry>> batches(partitions.size());
+        for (size_t i = 0; i < N; ++i){
+            read_row(is, row);
+            std::vector<TableEntry>& batch = batches[partition_of(row[partition_col])];
+            std::move(row.begin(), row.end(), std::back_inserter(batch));
+        }
+
+        std::vector<WriteLock> locks = lock_partitions();
+        run_parts(partitions.size(), [&](size_t p){
+            Table& partition = partitions[p];
+            std::vector<TableEntry>& batch = batches[p];
+            std::vector<TableEntry> cells;
+            size_t first = partition.table2D.size(), count = batch.size() / num_cols;
+            partition.table2D.reserve(first + count);
+            for (size_t i = 0; i < count; ++i){
+                auto row_begin = batch.begin() + static_cast<std::ptrdiff_t>(i * num_cols);
+                cells.clear();
+                std::move(row_begin, row_begin + static_cast<std::ptrdiff_t>(num_cols), std::back_inserter(cells));
+                partition.table2D.push_row(cells);
+            }
+            partition.index_rows(first, first + count);
+        });
+        {
+            std::lock_guard<std::mutex> guard(versions->mutex);
+            for (size_t p = 0; p < partitions.size(); ++p){
+                partitions[p].publish_rows(batches[p].size() / num_cols);
+            }
+        }
+    }
 
-    size_t curr_size = table2D.size();
-    table2D.resize(curr_size + N);
+    os << "Added " << N << " rows to " << table_name << " from position " << first_position << " to " << first_position + N - 1 << '\n';
+    collect_garbage();
+
+}// end of Table::insert
 
-    for (size_t i = curr_size; i < curr_size + N; ++i){
-        table2D[i].reserve(columnNames.size());
+void Table::read_row(std::istream& is, std::vector<TableEntry>& row) const {
+        row.clear();
 
         for (size_t j = 0; j < columnNames.size(); ++j){
 
             std::string input;
-            std::cin >> input;
+            is >> input;
 
             if (columnTypes[j] == EntryType::String){
-                table2D[i].emplace_back(TableEntry(input));
+                row.emplace_back(TableEntry(input));
             } else if (columnTypes[j] == EntryType::Bool){
                 if (input == "true"){ 
-                    table2D[i].emplace_back(TableEntry(true));
+                    row.emplace_back(TableEntry(true));
                 }
                 else{ 
-                    table2D[i].emplace_back(TableEntry(false));
+                    row.emplace_back(TableEntry(false));
                 }
             } else if (columnTypes[j] == EntryType::Int){ 
-                table2D[i].emplace_back(TableEntry(std::stoi(input)));
+                row.emplace_back(TableEntry(std::stoi(input)));
             } else if (columnTypes[j] == EntryType::Double){
-                table2D[i].emplace_back(TableEntry(std::stof(input)));
+                row.emplace_back(TableEntry(std::stof(input)));
             } /*else if (columnTypes[j] == EntryType::Double){
                 std::ostringstream oss;
                 oss << input;
@@ -382,558 +1558,2055 @@ void Table::insert(){
 
                 double d = std::round(std::stof(input) * rounder) / rounder;
            
-                table2D[i].emplace_back(TableEntry(d));
+                row.emplace_back(TableEntry(d));
             }*/
             }
     }
 
-        if (index_type == IndexType::HASH){
-            for (size_t i = curr_size; i < curr_size + N; ++i){
-                hashTable[table2D[i][col_of_generated_index]].push_back(i);
-            }
-            can_use_generated_index = (hashTable.size() == 0) ? false : true; 
-        } else if (index_type == IndexType::BST){
-            for (size_t i = curr_size; i < curr_size + N; ++i){
-                bst[table2D[i][col_of_generated_index]].push_back(i);
+void Table::index_rows(size_t first, size_t last){
+        //snapshot readers skip postings past their row count, so the new rows can go in before they're published
+        WriteLock index_writer(*index_latch);
+        indexed_rows = last;
+        if (index_type != IndexType::NONE){
+            if (index_type == IndexType::HASH){
+                add_postings(table2D, col_of_generated_index, first, last, hashTable);
+                can_use_generated_index = (hashTable.size() == 0) ? false : true; 
+            } else if (index_type == IndexType::BST){
+                add_postings(table2D, col_of_generated_index, first, last, bst);
+                can_use_generated_index = (bst.size() == 0) ? false : true; 
+            } else {
+                add_postings(table2D, col_of_generated_index, first, last, bitmaps);
+                can_use_generated_index = (bitmaps.size() == 0) ? false : true; 
             }
-            can_use_generated_index = (bst.size() == 0) ? false : true; 
         }
+    }
 
+void Table::publish_rows(size_t count){
+        std::lock_guard<std::mutex> guard(versions->mutex);
+        versions->published_rows = table2D.size();
+        versions->live_rows += count;
+        ++versions->version;
+    }
 
-
-    //     std::cout << "Debugging Table: " << table_name << std::endl;
-    // std::cout << "Column Names: ";
-    // for (const auto& columnName : columnNames) {
-    //     std::cout << columnName << " ";
-    // }
-    // std::cout << std::endl;
-
-    // std::cout << "Table Data:" << std::endl;
-    // for (const auto& row : table2D) {
-    //     for (const auto& entry : row) {
-    //         std::cout << entry << " ";
-    //     }
-    //     std::cout << std::endl;
-    // }
-
-
-    std::cout << "Added " << N << " rows to " << table_name << " from position " << curr_size << " to " << curr_size + N - 1 << '\n';
-
-}// end of Table::insert
-
-void Table::print(){
+void Table::print(std::istream& is, std::ostream& os, const std::vector<Snapshot>& snaps){
     size_t N;
-    std::cin >> N;
+    is >> N;
     std::vector<size_t> print_table_col_idxs;
     std::string name_of_col;
 
     for (size_t i = 0; i < N; ++i){
-        std::cin >> name_of_col;
-        auto it = std::find(columnNames.begin(), columnNames.end(), name_of_col);
-         if (it == columnNames.end()){
-            std::cout << "Error during PRINT: " << name_of_col << " does not name a column in " << table_name << '\n';
-            std::getline(std::cin, name_of_col);
+        is >> name_of_col;
+        size_t comp_idx = column_index(name_of_col);
+         if (comp_idx == columnNames.size()){
+            os << "Error during PRINT: " << name_of_col << " does not name a column in " << table_name << '\n';
+            std::getline(is, name_of_col);
             return;
         }
-        size_t comp_idx = static_cast<size_t>(std::distance(columnNames.begin(), it));
         print_table_col_idxs.push_back(comp_idx);
     }
 
-        std::cin >> name_of_col; // WHERE / ALL
-
-        //ALL
-        if (name_of_col == "ALL"){
-        if (!quiet){
-            for (size_t c = 0; c < print_table_col_idxs.size(); ++c){
-                std::cout << columnNames[print_table_col_idxs[c]] << " ";
-            }
-            std::cout << '\n';
+        is >> name_of_col; // WHERE / ALL
+        std::string rest_of_line;
+        std::getline(is, rest_of_line);
+        std::istringstream clause(rest_of_line);
 
-            for (size_t i = 0; i < table2D.size(); ++i){
-                for (size_t c = 0; c < print_table_col_idxs.size(); ++c){
-                    std::cout << table2D[i][print_table_col_idxs[c]] << " ";
-                }
-                std::cout << '\n';
-            }
+        //WHERE: parse the whole clause before anything gets printed
+        WhereClause where;
+        if (name_of_col != "ALL" && !parse_where(clause, "PRINT", where, os)){
+            return;
         }
-        std::cout << "Printed " << table2D.size() << " matching rows from " << table_name << '\n';
-        return;
+        OrderBy order;
+        if (!parse_order(clause, order, os)){
+            return;
         }
+        use_deferred_index(where);
 
-        //WHERE: check if colname is valid
-        std::cin >> name_of_col; // WHERE colname
-        auto it = std::find(columnNames.begin(), columnNames.end(), name_of_col);
-        if (it == columnNames.end()){
-            std::cout << "Error during PRINT: " << name_of_col << " does not name a column in " << table_name << '\n';
-            std::getline(std::cin, name_of_col);
+        //the same query against the same version of the table prints the same bytes
+        std::string key = print_cache_key(print_table_col_idxs, where, order);
+        uint64_t version = 0;
+        for (const Snapshot& snap : snaps){
+            version += snap.version;
+        }
+        if (ResultCache::Bytes cached = print_cache->find(key, version)){
+            os.write(cached->data(), static_cast<std::streamsize>(cached->size()));
             return;
         }
-        size_t comp_idx = static_cast<size_t>(std::distance(columnNames.begin(), it));
-        
-        char opr;
-        std::cin >> opr;
 
+        CaptureBuf capture(os.rdbuf(), print_cache->max_entry_bytes());
+        std::ostream out(&capture);
+        out.copyfmt(os);
+        print_rows_helper(where, order, print_table_col_idxs, snaps, out);
+        out.flush();
+        if (capture.complete()){
+            print_cache->insert(key, version, capture.take());
+        }
+    }
 
-        switch(columnTypes[comp_idx]){
-            case EntryType::Bool :{
-                bool b;
-                std::cin >> b;
-                TableEntry t(b);
-                print_rows_helper(comp_idx, opr, t, print_table_col_idxs);
-                break;
-            }
-            case EntryType::String :{
-                std::string s;
-                std::cin >> s;
-                TableEntry t(s);
-                print_rows_helper(comp_idx, opr, t, print_table_col_idxs);
-                break;
-            }
-            case EntryType::Double :{
-                double d;
-                std::cin >> d;
-                TableEntry t(d);
-                print_rows_helper(comp_idx, opr, t, print_table_col_idxs);
-                break;
+// columns, WHERE terms (values written out exactly) and ORDER BY, so differently spaced queries share an entry
+std::string Table::print_cache_key(const std::vector<size_t>& columns_to_print, const WhereClause& where, const OrderBy& order) const {
+        std::ostringstream key;
+        key << std::hexfloat;
+        for (size_t c : columns_to_print){
+            key << c << ',';
+        }
+        auto value = [&](size_t col, const TableEntry& entry){
+            switch (columnTypes[col]){
+                case EntryType::String:
+                    key << entry.as<std::string>().size() << ':' << entry.as<std::string>();
+                    break;
+                case EntryType::Double:
+                    key << entry.as<double>();
+                    break;
+                case EntryType::Int:
+                    key << entry.as<int>();
+                    break;
+                case EntryType::Bool:
+                    key << entry.as<bool>();
+                    break;
             }
-            case EntryType::Int :{
-                int i;
-                std::cin >> i;
-                TableEntry t(i);
-                print_rows_helper(comp_idx, opr, t, print_table_col_idxs);
-                break;
+        };
+        for (const std::vector<Predicate>& conjunction : where){
+            key << '|';
+            for (const Predicate& pred : conjunction){
+                key << '&' << pred.col << pred.op;
+                value(pred.col, pred.value);
+                if (pred.op == 'B'){
+                    key << ',';
+                    value(pred.col, pred.value_hi);
+                }
             }
         }
+        key << '#' << order.active << order.col << ',' << order.descending << order.limit;
+        return key.str();
     }
 
-void Table::print_rows_helper(size_t print_compare_column_index, char op, const TableEntry& value, std::vector<size_t>& columns_to_print){
-        //size of col rows to output will tell how many rows we need to print
-        size_t num_rows_printed = 0;
-
+void Table::print_rows_helper(const WhereClause& where, const OrderBy& order, std::vector<size_t>& columns_to_print, const std::vector<Snapshot>& snaps, std::ostream& os){
         if (!quiet){
             for (size_t i = 0; i < columns_to_print.size(); ++i){
-                std::cout << columnNames[columns_to_print[i]] << " ";
-            }
-            std::cout << '\n';
-        }
-
-        switch (op){
-            case '<':
-            {
-                    if (index_type == IndexType::BST && print_compare_column_index == col_of_generated_index && can_use_generated_index){
-
-                        auto search_for_idx = bst.lower_bound(value);
-                        for (auto x = bst.begin(); x != search_for_idx; x++) {
-                            for (size_t r : x->second) {
-                                if (!quiet) {
-                                    for (size_t c : columns_to_print) {
-                                        std::cout << table2D[r][c] << " ";
-                                    }
-                                    std::cout << '\n';
-                                }
-                            num_rows_printed++;
-                            }
-                        }
-
-                    } else {
-
-                        for (size_t row = 0; row < table2D.size(); ++row){
-                            if (table2D[row][print_compare_column_index] < value){
-                            if (!quiet){
-                            for (size_t i = 0; i < columns_to_print.size(); ++i){
-                                std::cout << table2D[row][columns_to_print[i]] << " ";
-                            }
-                            std::cout << '\n';
-                            }
-                            ++num_rows_printed;
-                            }
-                        }
+                os << columnNames[columns_to_print[i]] << " ";
+            }
+            os << '\n';
+        }
 
+        //ALL, partitions one after another
+        if (where.empty() && !order.active && order.limit == SIZE_MAX){
+            size_t num_live = 0;
+            for (size_t p = 0; p < num_parts(); ++p){
+                const RowStore& rows = part(p).table2D;
+                const Snapshot& snap = snaps[p];
+                num_live += snap.live;
+                if (quiet){
+                    continue;
+                }
+                for (size_t i = 0; i < snap.rows; ++i){
+                    if (!rows.visible(i, snap)){
+                        continue;
                     }
-                std::cout << "Printed " << num_rows_printed << " matching rows from " << table_name << '\n';
-                break;
+                    for (size_t c : columns_to_print){
+                        os << rows[i][c] << " ";
+                    }
+                    os << '\n';
+                }
             }
-            case '>':
-            {
-                if (index_type == IndexType::BST && print_compare_column_index == col_of_generated_index && can_use_generated_index){
-                        auto search_for_idx = bst.upper_bound(value);
-
-                        for (auto x = search_for_idx; x != bst.end(); ++x) {
-                            for (size_t r : x->second) {
-                                if (!quiet) {
-                                    for (size_t c : columns_to_print) {
-                                        std::cout << table2D[r][c] << " ";
-                                    }
-                                std::cout << '\n';
-                                }
-                            ++num_rows_printed;
-                            }
-                        }
+            os << "Printed " << num_live << " matching rows from " << table_name << '\n';
+            return;
+        }
 
-                    } else {
+        //quiet mode only prints the count, which a bitmap index has without looking at a row
+        if (quiet && !order.active && order.limit == SIZE_MAX && where.size() == 1 && where[0].size() == 1){
+            size_t count = 0;
+            bool counted = true;
+            for (size_t p = 0; p < num_parts() && counted; ++p){
+                ReadLock index_reader(*part(p).index_latch);
+                std::optional<size_t> part_count = part(p).bitmap_count(where[0][0], snaps[p]);
+                counted = part_count.has_value();
+                count += part_count.value_or(0);
+            }
+            if (counted){
+                os << "Printed " << count << " matching rows from " << table_name << '\n';
+                return;
+            }
+        }
 
-                        for (size_t row = 0; row < table2D.size(); ++row){
-                            if (table2D[row][print_compare_column_index] > value){
-                            if (!quiet){
-                            for (size_t i = 0; i < columns_to_print.size(); ++i){
-                                std::cout << table2D[row][columns_to_print[i]] << " ";
-                            }
-                            std::cout << '\n';
-                            }
-                            ++num_rows_printed;
-                            }
-                        }
-                        
-                    }
-                std::cout << "Printed " << num_rows_printed << " matching rows from " << table_name << '\n';
-                break;
+        //every part finds, orders and cuts its own rows
+        std::vector<std::vector<size_t>> part_rows(num_parts());
+        run_parts(num_parts(), [&](size_t p){
+            const Table& t = part(p);
+            ReadLock index_reader(*t.index_latch);
+            if (!where.empty()){
+                part_rows[p] = t.select_rows(where, false, snaps[p]);
             }
-            case '=':
-            {   
-   
-            if (index_type == IndexType::BST && print_compare_column_index == col_of_generated_index && can_use_generated_index) {
-                auto range = bst.equal_range(value); // Get range of elements equal to value
-
-                for (auto it = range.first; it != range.second; ++it) {
-                    for (size_t r : it->second) {
-                        if (!quiet) {
-                            for (size_t col_idx : columns_to_print) {
-                                std::cout << table2D[r][col_idx] << " ";
-                            }
-                            std::cout << '\n';
-                        }
-                        ++num_rows_printed;
+            t.order_rows(part_rows[p], where.empty(), order, snaps[p]);
+        });
+
+        if (!partitioned()){
+            if (!quiet){
+                for (size_t r : part_rows[0]){
+                    for (size_t c : columns_to_print){
+                        os << table2D[r][c] << " ";
                     }
+                    os << '\n';
                 }
+            }
+            os << "Printed " << part_rows[0].size() << " matching rows from " << table_name << '\n';
+            return;
+        }
 
-                // auto idx = bst.find(value);
-                // if (idx != bst.end()){
-                //     num_rows_printed += idx->second.size();
-                //     if (!quiet){
-                //         for (size_t r : idx->second){
-                //             for (size_t c: columns_to_print){
-                //                 std::cout << table2D[r][c] << " ";
-                //             }
-                //             std::cout << '\n';
-                //         }
-                //     }
-                // }
-
-                } else if (index_type == IndexType::HASH && col_of_generated_index == print_compare_column_index && can_use_generated_index){
-                        
-                        auto it = hashTable.find(value); // Find the entry in hash table
-                        if (it != hashTable.end()) {
-                        for (size_t r : it->second) {
-                        if (!quiet) {
-                            for (size_t col_idx : columns_to_print) {
-                                std::cout << table2D[r][col_idx] << " ";
-                            }
-                            std::cout << '\n';
-                        }
-                        ++num_rows_printed;
-                        }
+        //partitions go one after another, or are merged on the ORDER BY column (ties to the lower partition)
+        std::vector<std::pair<size_t, size_t>> rows; // (partition, row)
+        if (!order.active){
+            for (size_t p = 0; p < num_parts(); ++p){
+                for (size_t r : part_rows[p]){
+                    if (rows.size() == order.limit){
+                        break;
+                    }
+                    rows.emplace_back(p, r);
                 }
-                } else {
-                for (size_t row = 0; row < table2D.size(); ++row){
-                    if (table2D[row][print_compare_column_index] == value){
-                        if (!quiet){
-                            for (size_t i = 0; i < columns_to_print.size(); ++i){
-                                std::cout << table2D[row][columns_to_print[i]] << " ";
-                            }
-                            std::cout << '\n';
-                        }
-                        ++num_rows_printed;
+            }
+        } else {
+            std::vector<size_t> next(num_parts(), 0);
+            while (rows.size() < order.limit){
+                size_t best = SIZE_MAX;
+                for (size_t p = 0; p < num_parts(); ++p){
+                    if (next[p] == part_rows[p].size()){
+                        continue;
+                    }
+                    if (best == SIZE_MAX){
+                        best = p;
+                        continue;
                     }
+                    const TableEntry& val = part(p).table2D[part_rows[p][next[p]]][order.col];
+                    const TableEntry& best_val = part(best).table2D[part_rows[best][next[best]]][order.col];
+                    if (order.descending ? (best_val < val) : (val < best_val)){
+                        best = p;
+                    }
+                }
+                if (best == SIZE_MAX){
+                    break;
                 }
+                rows.emplace_back(best, part_rows[best][next[best]++]);
             }
-
-            std::cout << "Printed " << num_rows_printed << " matching rows from " << table_name << '\n';
-            break;
-
-            default:
-                std::cerr << "Operator must be one of >, <, =\n";
-                return;
         }
-    }
-}
 
-void Table::delete_rows(){
-        std::string colname;
-        std::cin >> colname; // WHERE
-        std::cin >> colname; // colname
-       
-        auto it = std::find(columnNames.begin(), columnNames.end(), colname);
-        
-        if (it == columnNames.end()){
-            std::cout << "Error during DELETE: " << colname << " does not name a column in " << table_name << '\n';
-            std::getline(std::cin, colname);
-            return;
+        if (!quiet){
+            for (auto [p, r] : rows){
+                const RowStore& table_rows = partitions[p].table2D;
+                for (size_t c : columns_to_print){
+                    os << table_rows[r][c] << " ";
+                }
+                os << '\n';
+            }
         }
-        size_t comp_idx = static_cast<size_t>(std::distance(columnNames.begin(), it));
-
-        // std::cout << "Index of column to compare: " << comp_idx;
-
-        char opr;
-        std::cin >> opr;
+        os << "Printed " << rows.size() << " matching rows from " << table_name << '\n';
+    }
 
-        switch(columnTypes[comp_idx]){
-            case EntryType::Bool :{
-                bool b;
-                std::cin >> b;
-                TableEntry t(b);
-                delete_rows_helper(comp_idx, opr, t);
-                break;
+// reads the rest of the command line as <pred> { AND|OR <pred> }
+// prints the error and returns false if a column doesn't exist
+bool Table::parse_where(std::istream& clause, const std::string& command_name, WhereClause& where, std::ostream& os) const {
+        std::string col_name, op, connective;
+        where.emplace_back();
+        while (clause >> col_name){
+            size_t col = column_index(col_name);
+            if (col == columnNames.size()){
+                os << "Error during " << command_name << ": " << col_name << " does not name a column in " << table_name << '\n';
+                return false;
             }
-            case EntryType::String :{
-                std::string s;
-                std::cin >> s;
-                TableEntry t(s);
-                delete_rows_helper(comp_idx, opr, t);
-                break;
+
+            clause >> op;
+            if (op == "BETWEEN"){
+                TableEntry lo = read_value(clause, columnTypes[col]);
+                clause >> connective; // AND
+                TableEntry hi = read_value(clause, columnTypes[col]);
+                where.back().emplace_back(col, 'B', lo, hi);
+            } else if (op == "<" || op == ">" || op == "="){
+                TableEntry value = read_value(clause, columnTypes[col]);
+                where.back().emplace_back(col, op[0], value, value);
+            } else {
+                std::cerr << "Operator must be one of >, <, =, BETWEEN\n";
+                return false;
             }
-            case EntryType::Double :{
-                double d;
-                std::cin >> d;
-                TableEntry t(d);
-                delete_rows_helper(comp_idx, opr, t);
+
+            auto before_connective = clause.tellg();
+            if (!(clause >> connective)){
                 break;
             }
-            case EntryType::Int :{
-                int i;
-                std::cin >> i;
-                TableEntry t(i);
-                delete_rows_helper(comp_idx, opr, t);
+            if (connective == "OR"){
+                where.emplace_back();
+            } else if (connective != "AND"){
+                //end of the clause, leave the word for whoever parses next
+                clause.seekg(before_connective);
                 break;
             }
         }
+        return !where.back().empty();
     }
 
-void Table::delete_rows_helper(size_t delete_column_index, char op, const TableEntry& value){
-        size_t num_rows_deleted = 0;
-        size_t initial_size = table2D.size();
-
-        switch (op){
-            case '<':
-            {
-                less lessComp(delete_column_index, value);
-                table2D.erase(remove_if(table2D.begin(), table2D.end(), lessComp), table2D.end());
-                // for (size_t i = 0; i < table2D.size(); ++i){
-                //     if (less{delete_column_index, value}(table2D[i])){
-                //         rows_to_delete.push_back(i);
-                //     }
-                // }
-
-                break;
+// [ORDER BY <colname> [ASC|DESC]] [LIMIT <k>], and nothing after it
+// prints the error and returns false on anything else, so a typo can't quietly run a different query
+bool Table::parse_order(std::istream& is, OrderBy& order, std::ostream& os) const {
+        std::string word;
+        if (!(is >> word)){
+            return true;
+        }
+        if (word == "ORDER"){
+            std::string by, col_name;
+            is >> by >> col_name;
+            if (by != "BY"){
+                os << "Error during PRINT: ORDER must be followed by BY, not " << by << '\n';
+                return false;
             }
-            case '>':
-            {
-                greater greaterComp(delete_column_index, value);
-                table2D.erase(remove_if(table2D.begin(), table2D.end(), greaterComp), table2D.end());
-                // for (size_t i = 0; i < table2D.size(); ++i){
-                //     if (greater{delete_column_index, value}(table2D[i])){
-                //         rows_to_delete.push_back(i);
-                //     }
-                // }
-
-                break;
+            size_t col = column_index(col_name);
+            if (col == columnNames.size()){
+                os << "Error during PRINT: " << col_name << " does not name a column in " << table_name << '\n';
+                return false;
             }
-            case '=':
-            {
-                equal equalComp(delete_column_index, value, columnTypes[delete_column_index]);
-                table2D.erase(remove_if(table2D.begin(), table2D.end(), equalComp), table2D.end());
-                // for (size_t i = 0; i < table2D.size(); ++i){
-                //     if (equal{delete_column_index, value}(table2D[i])){
-                //         rows_to_delete.push_back(i);
-                //     }
-                // }
-
-                break;
+            order.active = true;
+            order.col = col;
+            if (!(is >> word)){
+                return true;
+            }
+            if (word == "ASC" || word == "DESC"){
+                order.descending = (word == "DESC");
+                if (!(is >> word)){
+                    return true;
+                }
             }
-            default:
-                std::cerr << "Operator must be one of >, <, =\n";
-                return;
         }
-
-        num_rows_deleted = initial_size - table2D.size();
-        std::cout << "Deleted " << num_rows_deleted << " rows from " << table_name << '\n';
-
-        if (index_type == IndexType::HASH){
-            //regenerate Hash index
-            hashTable.clear();
-            for (size_t i = 0; i < table2D.size(); ++i){
-                hashTable[table2D[i][col_of_generated_index]].push_back(i);
+        if (word == "LIMIT"){
+            if (!(is >> order.limit)){
+                os << "Error during PRINT: LIMIT must be followed by a number of rows\n";
+                return false;
             }
-            can_use_generated_index = (hashTable.size() == 0) ? false : true;
-        } else if (index_type == IndexType::BST){
-            //regenerate Bst index
-            bst.clear();
-            for (size_t i = 0; i < table2D.size(); ++i){
-                bst[table2D[i][col_of_generated_index]].push_back(i);
+            if (!(is >> word)){
+                return true;
             }
-            can_use_generated_index = (bst.size() == 0) ? false : true;
         }
-        
+        os << "Error during PRINT: " << word << " is not part of [ORDER BY <colname> [ASC|DESC]] [LIMIT <k>]\n";
+        return false;
     }
 
-void SillyQL::join(const Table& table1, const Table& table2){
-        std::string table1_column_to_compare;
-        std::string table2_column_to_compare;
-        std::string junk;
+// compares two rows on the ORDER BY column; T is the column's type, ties keep table order
+template <typename T>
+struct OrderCompare {
+    const RowStore& table2D;
+    size_t col;
+    bool descending;
+
+    bool operator()(size_t a, size_t b) const {
+        T va = table2D[a][col].as<T>();
+        T vb = table2D[b][col].as<T>();
+        if (va < vb) return !descending;
+        if (vb < va) return descending;
+        return a < b;
+    }
+};
 
-        std::cin >> junk; //WHERE
-        std::cin >> table1_column_to_compare; // Table 1's column to compare
+template <typename T>
+static void sort_rows(const RowStore& table2D, std::vector<size_t>& rows, const OrderBy& order){
+    OrderCompare<T> comp{table2D, order.col, order.descending};
+    if (order.limit < rows.size()){
+        //top-K: heap select the first k, only those get sorted
+        std::partial_sort(rows.begin(), rows.begin() + static_cast<std::ptrdiff_t>(order.limit), rows.end(), comp);
+        rows.resize(order.limit);
+    } else {
+        std::sort(rows.begin(), rows.end(), comp);
+    }
+}
 
-        auto tb1_it = std::find(table1.columnNames.begin(), table1.columnNames.end(), table1_column_to_compare);
-        if (tb1_it == table1.columnNames.end()){
-            std::cout << "Error during JOIN: " << table1_column_to_compare << " does not name a column in " << table1.table_name << '\n';
-            std::getline(std::cin, junk);
+void Table::order_rows(std::vector<size_t>& rows, bool all_rows, const OrderBy& order, const Snapshot& snap) const {
+        size_t limit = std::min(order.limit, all_rows ? snap.live : rows.size());
+
+        //walking the bst is already sorted; worth it when most of the table is in play
+        if (order.active && index_type == IndexType::BST && can_use_generated_index && col_of_generated_index == order.col
+                && (all_rows || rows.size() * 4 >= snap.live)){
+            std::vector<bool> selected;
+            if (!all_rows){
+                selected.assign(snap.rows, false);
+                for (size_t r : rows){
+                    selected[r] = true;
+                }
+            }
+            rows.clear();
+            auto take_bucket = [&](const std::vector<size_t>& postings){
+                for (size_t r : postings){
+                    if (rows.size() == limit){
+                        return;
+                    }
+                    if (!table2D.visible(r, snap)){
+                        continue;
+                    }
+                    if (all_rows || selected[r]){
+                        rows.push_back(r);
+                    }
+                }
+            };
+            if (order.descending){
+                for (auto it = bst.rbegin(); it != bst.rend() && rows.size() < limit; ++it){
+                    take_bucket(it->second);
+                }
+            } else {
+                for (auto it = bst.begin(); it != bst.end() && rows.size() < limit; ++it){
+                    take_bucket(it->second);
+                }
+            }
             return;
         }
 
-        std::cin >> junk; // =
-        std::cin >> table2_column_to_compare; // Table 2's column to compare
-
-
-        auto tb2_it = std::find(table2.columnNames.begin(), table2.columnNames.end(), table2_column_to_compare);
-        if (tb2_it == table2.columnNames.end()){
-            std::cout << "Error during JOIN: " << table2_column_to_compare << " does not name a column in " << table2.table_name << '\n';
-            std::getline(std::cin, junk);
+        if (all_rows){
+            rows.reserve(snap.live);
+            SequentialScan scan(table2D, snap.rows);
+            for (size_t r = 0; r < snap.rows; ++r){
+                if (table2D.visible(r, snap)){
+                    rows.push_back(r);
+                }
+            }
+        }
+        if (!order.active){
+            rows.resize(limit);
             return;
         }
 
-        //Now that we know that both table names exist
-        std::cin >> junk; // "AND"
-        std::cin >> junk; // "PRINT"
+        //dispatch on the column type once, not once per comparison
+        switch (columnTypes[order.col]){
+            case EntryType::String:
+                sort_rows<std::string>(table2D, rows, order);
+                break;
+            case EntryType::Double:
+                sort_rows<double>(table2D, rows, order);
+                break;
+            case EntryType::Int:
+                sort_rows<int>(table2D, rows, order);
+                break;
+            case EntryType::Bool:
+                sort_rows<bool>(table2D, rows, order);
+                break;
+        }
+    }
 
-        size_t N; // num of columns to print from both tables
-        std::cin >> N;
+TableEntry Table::read_value(std::istream& is, EntryType type) const {
+        switch(type){
+            case EntryType::Bool :{
+                bool b = false;
+                is >> std::boolalpha >> b;
+                return TableEntry(b);
+            }
+            case EntryType::String :{
+                std::string s;
+                is >> s;
+                return TableEntry(s);
+            }
+            case EntryType::Double :{
+                double d = 0;
+                is >> d;
+                return TableEntry(d);
+            }
+            case EntryType::Int :{
+                int i = 0;
+                is >> i;
+                return TableEntry(i);
+            }
+        }
+        std::terminate();
+    }
 
-        std::string column_name_to_search;
-        int table_num;
+std::vector<size_t> Table::select_rows(const WhereClause& where, bool fuzzy_double_equal, const Snapshot& snap) const {
+        if (where.size() == 1){
+            return select_conjunction(where.front(), fuzzy_double_equal, snap);
+        }
 
-        std::vector< std::pair <int, size_t> > cols_ov;
+        //OR: union of every group, back in table order
+        std::vector<size_t> rows;
+        for (const auto& conjunction : where){
+            std::vector<size_t> group_rows = select_conjunction(conjunction, fuzzy_double_equal, snap);
+            rows.insert(rows.end(), group_rows.begin(), group_rows.end());
+        }
+        std::sort(rows.begin(), rows.end());
+        rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+        return rows;
+    }
 
-        for (size_t i = 0; i < N; ++i){
-            std::cin >> column_name_to_search;
-            std::cin >> table_num;
-
-            const Table& table_to_search = (table_num == 1) ? table1 : table2;
-            auto tb_it = std::find(table_to_search.columnNames.begin(), table_to_search.columnNames.end(), column_name_to_search);
-            if (tb_it == table_to_search.columnNames.end()){
-                std::cout << "Error during JOIN: " << column_name_to_search << " does not name a column in " << table_to_search.table_name << '\n';
-                std::getline(std::cin, junk);
-                return;
-            } else {
-                size_t col_idx = static_cast<size_t>(std::distance(table_to_search.columnNames.begin(), tb_it));
-                cols_ov.push_back(std::pair(table_num, col_idx));
+std::vector<size_t> Table::select_conjunction(const std::vector<Predicate>& conjunction, bool fuzzy_double_equal, const Snapshot& snap) const {
+        //drive with whichever term the index narrows down the most; DELETE's double = matches values as
+        //they print (see PrintedEqualTo), which an index's exact keys can't answer, so that term always gets scanned
+        size_t driver = conjunction.size();
+        size_t driver_estimate = SIZE_MAX;
+        for (size_t p = 0; p < conjunction.size(); ++p){
+            const Predicate& pred = conjunction[p];
+            if (fuzzy_double_equal && pred.op == '=' && columnTypes[pred.col] == EntryType::Double){
+                continue;
+            }
+            size_t estimate = index_estimate(pred);
+            if (estimate < driver_estimate){
+                driver = p;
+                driver_estimate = estimate;
             }
         }
 
-        if (!table1.quiet){
-            for (size_t i = 0; i < cols_ov.size(); ++i){
-                const Table& output_table = (cols_ov[i].first == 1) ? table1 : table2;
-                std::cout << output_table.columnNames[cols_ov[i].second] << " ";
+        //remaining terms get checked cheapest first so most rows fail early
+        std::vector<size_t> residual;
+        for (size_t p = 0; p < conjunction.size(); ++p){
+            if (p != driver){
+                residual.push_back(p);
             }
-            std::cout << '\n';
         }
-        
-        size_t tb1_col_to_compare_idx = static_cast<size_t>(std::distance(table1.columnNames.begin(), tb1_it));
-        size_t tb2_col_to_compare_idx = static_cast<size_t>(std::distance(table2.columnNames.begin(), tb2_it));
-
-        size_t num_rows_printed = 0;
-        
-        //generate a hash map for the values of the desired column in table 2
-        std::unordered_map<TableEntry, std::vector<size_t>> join_hash;
-        generate_col_idx(table2, tb2_col_to_compare_idx, join_hash);
-
-        for (size_t i = 0; i < table1.table2D.size(); ++i){
-            const TableEntry& t1val = table1.table2D[i][tb1_col_to_compare_idx];
-
-            auto hash_it = join_hash.find(t1val);
-            if (hash_it != join_hash.end()){
-                for (size_t j = 0; j < hash_it->second.size(); ++j){
-                    if (!quietMode){
-                    for (size_t k = 0; k < cols_ov.size(); ++k){
-                        const Table& table_to_print = (cols_ov[k].first == 1) ? table1 : table2;
-                        size_t row_idx_to_print = (cols_ov[k].first == 1) ? i : hash_it->second[j];
-                        std::cout << table_to_print.table2D[row_idx_to_print][cols_ov[k].second] << " ";
-                    }
-                    std::cout << '\n';
+        std::stable_sort(residual.begin(), residual.end(), [&](size_t a, size_t b){
+            return predicate_cost(conjunction[a]) < predicate_cost(conjunction[b]);
+        });
+
+        //adaptive mode takes the cheapest range term to the cracker instead
+        auto crackable = [&](size_t p){
+            const Predicate& pred = conjunction[p];
+            if (!adaptive || pred.op == '=' || columnTypes[pred.col] == EntryType::String){
+                return false;
+            }
+            //a NaN bound can't be placed among the cracker's cuts
+            return columnTypes[pred.col] != EntryType::Double || (!std::isnan(pred.value.as<double>()) && !std::isnan(pred.value_hi.as<double>()));
+        };
+        auto cracked = std::find_if(residual.begin(), residual.end(), crackable);
+
+        std::vector<size_t> rows;
+        size_t next = 0;
+        if (driver != conjunction.size()){
+            rows.reserve(driver_estimate);
+            index_lookup(conjunction[driver], snap, rows);
+        } else if (cracked != residual.end()){
+            crack_lookup(conjunction[*cracked], snap, rows);
+            residual.erase(cracked);
+        } else {
+            //no index: the cheapest term scans the blocks no term's zone map rules out, everything after only sees its survivors
+            std::vector<ZoneMatch> blocks = scan_blocks(conjunction, residual[0], fuzzy_double_equal, snap);
+            apply_predicate(conjunction[residual[0]], fuzzy_double_equal, &blocks, snap, rows);
+            next = 1;
+        }
+        for (; next < residual.size() && !rows.empty(); ++next){
+            apply_predicate(conjunction[residual[next]], fuzzy_double_equal, nullptr, snap, rows);
+        }
+        return rows;
+    }
+
+// typed predicate kernels: T is the column's C++ type, so every row is a plain compare with no tag switch.
+// test() is the compare itself, which a packed block runs on its values directly
+template <typename T>
+struct LessThan {
+    using value_type = T;
+    size_t col;
+    T value;
+    bool test(const T& val) const { return val < value; }
+    bool operator()(const TableEntry* row) const { return test(row[col].as<T>()); }
+};
+template <typename T>
+struct GreaterThan {
+    using value_type = T;
+    size_t col;
+    T value;
+    bool test(const T& val) const { return val > value; }
+    bool operator()(const TableEntry* row) const { return test(row[col].as<T>()); }
+};
+template <typename T>
+struct EqualTo {
+    using value_type = T;
+    size_t col;
+    T value;
+    bool test(const T& val) const { return val == value; }
+    bool operator()(const TableEntry* row) const { return test(row[col].as<T>()); }
+};
+template <typename T>
+struct Between {
+    using value_type = T;
+    size_t col;
+    T lo, hi;
+    bool test(const T& val) const { return !(val < lo) && !(hi < val); }
+    bool operator()(const TableEntry* row) const { return test(row[col].as<T>()); }
+};
+// DELETE's double equality compares values as they print: six significant digits, read back as a float
+static double as_printed(double val){
+    char printed[32];
+    std::snprintf(printed, sizeof(printed), "%g", val);
+    return std::strtof(printed, nullptr);
+}
+
+// two as_printed values DELETE's = counts as equal
+static bool printed_equal(double a, double b){
+    return std::abs(a - b) < 1e-9;
+}
+
+struct PrintedEqualTo {
+    using value_type = double;
+    size_t col;
+    double value; // as_printed
+    bool test(double val) const { return printed_equal(as_printed(val), value); }
+    bool operator()(const TableEntry* row) const { return test(row[col].as<double>()); }
+};
+
+template <typename Kernel>
+static void run_kernel(const RowStore& table2D, const Kernel& kernel, const std::vector<ZoneMatch>* scan_blocks, const Snapshot& snap, std::vector<size_t>& rows){
+    if (scan_blocks){
+        SequentialScan scan(table2D, snap.rows);
+        size_t per_block = table2D.rows_per_slab();
+        for (size_t b = 0; b < scan_blocks->size(); ++b){
+            ZoneMatch match = (*scan_blocks)[b];
+            if (match == ZoneMatch::NONE){
+                continue;
+            }
+            size_t end = std::min(snap.rows, (b + 1) * per_block);
+            //a full block with a packed copy of the column is tested there instead of row by row
+            using T = typename Kernel::value_type;
+            if constexpr (std::is_arithmetic_v<T>){
+                const PackedColumn* packed = table2D.packed(b, kernel.col);
+                if (packed && match == ZoneMatch::SOME){
+                    size_t first = b * per_block;
+                    packed->select([&](double val){ return kernel.test(static_cast<T>(val)); },
+                                   [&](size_t i){
+                                       if (table2D.visible(first + i, snap)){
+                                           rows.push_back(first + i);
+                                       }
+                                   });
+                    continue;
+                }
+            }
+            for (size_t r = b * per_block; r < end; ++r){
+                if (table2D.visible(r, snap) && (match == ZoneMatch::ALL || kernel(table2D[r]))){
+                    rows.push_back(r);
+                }
+            }
+        }
+        return;
+    }
+    size_t keep = 0;
+    for (size_t r : rows){
+        if (kernel(table2D[r])){
+            rows[keep++] = r;
+        }
+    }
+    rows.resize(keep);
+}
+
+template <typename T>
+static void run_typed_predicate(const RowStore& table2D, const Predicate& pred, const std::vector<ZoneMatch>* scan_blocks, const Snapshot& snap, std::vector<size_t>& rows){
+    const T& value = pred.value.as<T>();
+    switch (pred.op){
+        case '<':
+            run_kernel(table2D, LessThan<T>{pred.col, value}, scan_blocks, snap, rows);
+            break;
+        case '>':
+            run_kernel(table2D, GreaterThan<T>{pred.col, value}, scan_blocks, snap, rows);
+            break;
+        case '=':
+            run_kernel(table2D, EqualTo<T>{pred.col, value}, scan_blocks, snap, rows);
+            break;
+        case 'B':
+            run_kernel(table2D, Between<T>{pred.col, value, pred.value_hi.as<T>()}, scan_blocks, snap, rows);
+            break;
+    }
+}
+
+void Table::apply_predicate(const Predicate& pred, bool fuzzy_double_equal, const std::vector<ZoneMatch>* scan_blocks, const Snapshot& snap, std::vector<size_t>& rows) const {
+        switch (columnTypes[pred.col]){
+            case EntryType::String:
+                run_typed_predicate<std::string>(table2D, pred, scan_blocks, snap, rows);
+                break;
+            case EntryType::Double:
+                if (fuzzy_double_equal && pred.op == '='){
+                    run_kernel(table2D, PrintedEqualTo{pred.col, as_printed(pred.value.as<double>())}, scan_blocks, snap, rows);
+                } else {
+                    run_typed_predicate<double>(table2D, pred, scan_blocks, snap, rows);
+                }
+                break;
+            case EntryType::Int:
+                run_typed_predicate<int>(table2D, pred, scan_blocks, snap, rows);
+                break;
+            case EntryType::Bool:
+                run_typed_predicate<bool>(table2D, pred, scan_blocks, snap, rows);
+                break;
+        }
+    }
+
+// a cell as its zone map sees it
+static double zone_value(const TableEntry& entry, EntryType type){
+    switch (type){
+        case EntryType::Double:
+            return entry.as<double>();
+        case EntryType::Int:
+            return entry.as<int>();
+        case EntryType::Bool:
+            return entry.as<bool>() ? 1 : 0;
+        case EntryType::String:
+            break;
+    }
+    return 0;
+}
+
+static ZoneMatch zone_match(const RowStore::Zone& zone, const Predicate& pred, EntryType type, bool fuzzy_double_equal){
+    if (zone.lo > zone.hi){
+        return ZoneMatch::NONE; // no rows
+    }
+    double value = zone_value(pred.value, type);
+    double lo = zone.lo, hi = zone.hi;
+    switch (pred.op){
+        case '<':
+            return (hi < value) ? ZoneMatch::ALL : (lo < value) ? ZoneMatch::SOME : ZoneMatch::NONE;
+        case '>':
+            return (lo > value) ? ZoneMatch::ALL : (hi > value) ? ZoneMatch::SOME : ZoneMatch::NONE;
+        case '=':
+            if (fuzzy_double_equal && type == EntryType::Double){
+                //printing keeps order, so the block's values all print within [as_printed(lo), as_printed(hi)]
+                value = as_printed(value);
+                lo = as_printed(lo);
+                hi = as_printed(hi);
+                return (printed_equal(lo, value) && printed_equal(hi, value)) ? ZoneMatch::ALL
+                     : (lo < value + 1e-9 && value - 1e-9 < hi) ? ZoneMatch::SOME : ZoneMatch::NONE;
+            }
+            return (lo == value && hi == value) ? ZoneMatch::ALL : (lo <= value && value <= hi) ? ZoneMatch::SOME : ZoneMatch::NONE;
+        case 'B': {
+            double value_hi = zone_value(pred.value_hi, type);
+            return (value <= lo && hi <= value_hi) ? ZoneMatch::ALL : (lo <= value_hi && value <= hi) ? ZoneMatch::SOME : ZoneMatch::NONE;
+        }
+    }
+    return ZoneMatch::SOME;
+}
+
+std::vector<ZoneMatch> Table::scan_blocks(const std::vector<Predicate>& conjunction, size_t scan_term, bool fuzzy_double_equal, const Snapshot& snap) const {
+        size_t per_block = table2D.rows_per_slab();
+        std::vector<ZoneMatch> blocks((snap.rows + per_block - 1) / per_block, ZoneMatch::SOME);
+        for (size_t p = 0; p < conjunction.size(); ++p){
+            const Predicate& pred = conjunction[p];
+            if (!table2D.zoned(pred.col)){
+                continue;
+            }
+            for (size_t b = 0; b < blocks.size(); ++b){
+                if (blocks[b] == ZoneMatch::NONE){
+                    continue;
+                }
+                ZoneMatch match = zone_match(table2D.zone(b, pred.col), pred, columnTypes[pred.col], fuzzy_double_equal);
+                if (match == ZoneMatch::NONE || p == scan_term){
+                    blocks[b] = match;
+                }
+            }
+        }
+        return blocks;
+    }
+
+// keys of an ordered index (bst or bitmaps) that satisfy pred, as [first, last)
+template <typename Index>
+static std::pair<typename Index::const_iterator, typename Index::const_iterator> key_range(const Index& index, const Predicate& pred){
+    switch (pred.op){
+        case '<':
+            return {index.begin(), index.lower_bound(pred.value)};
+        case '>':
+            return {index.upper_bound(pred.value), index.end()};
+        case '=':
+            return index.equal_range(pred.value);
+        default:
+            if (pred.value_hi < pred.value){
+                return {index.end(), index.end()};
+            }
+            return {index.lower_bound(pred.value), index.upper_bound(pred.value_hi)};
+    }
+}
+
+size_t Table::index_estimate(const Predicate& pred) const {
+        if (!can_use_generated_index || pred.col != col_of_generated_index){
+            return SIZE_MAX;
+        }
+
+        if (index_type == IndexType::HASH){
+            if (pred.op != '='){
+                return SIZE_MAX;
+            }
+            auto it = hashTable.find(pred.value);
+            return (it == hashTable.end()) ? 0 : it->second.size();
+        }
+
+        size_t estimate = 0;
+        auto add_range = [&](const auto& index){
+            auto [first, last] = key_range(index, pred);
+            for (auto it = first; it != last; ++it){
+                estimate += it->second.size();
+            }
+        };
+        if (index_type == IndexType::BST){
+            add_range(bst);
+        } else if (index_type == IndexType::BITMAP){
+            add_range(bitmaps);
+        } else {
+            return SIZE_MAX;
+        }
+        return estimate;
+    }
+
+//only called once index_estimate said the index can answer pred
+//postings can be newer than snap (past its row count) or deleted as of snap, those are skipped
+void Table::index_lookup(const Predicate& pred, const Snapshot& snap, std::vector<size_t>& rows) const {
+        auto take_postings = [&](const auto& postings){
+            for (size_t r : postings){
+                if (table2D.visible(r, snap)){
+                    rows.push_back(r);
+                }
+            }
+        };
+        auto take_range = [&](const auto& index){
+            auto [first, last] = key_range(index, pred);
+            for (auto it = first; it != last; ++it){
+                take_postings(it->second);
+            }
+        };
+        if (index_type == IndexType::HASH){
+            auto it = hashTable.find(pred.value);
+            if (it != hashTable.end()){
+                take_postings(it->second);
+            }
+        } else if (index_type == IndexType::BST){
+            take_range(bst);
+        } else {
+            take_range(bitmaps);
+        }
+    }
+
+//a bitmap's rows are in row order, so the ones a snapshot can see are a prefix unless something was deleted
+std::optional<size_t> Table::bitmap_count(const Predicate& pred, const Snapshot& snap) const {
+        if (index_type != IndexType::BITMAP || !can_use_generated_index || pred.col != col_of_generated_index || snap.filtered){
+            return std::nullopt;
+        }
+        size_t count = 0;
+        auto [first, last] = key_range(bitmaps, pred);
+        for (auto it = first; it != last; ++it){
+            count += it->second.rank(snap.rows);
+        }
+        return count;
+    }
+
+//cracks the column's copy on pred's bounds, then scans whatever was inserted after the copy was made
+void Table::crack_lookup(const Predicate& pred, const Snapshot& snap, std::vector<size_t>& rows) const {
+        auto bound = [&](const TableEntry& value, bool inclusive){
+            double v = (columnTypes[pred.col] == EntryType::Double) ? value.as<double>()
+                     : (columnTypes[pred.col] == EntryType::Int) ? value.as<int>() : (value.as<bool>() ? 1 : 0);
+            return std::optional<CrackerColumn::Bound>(CrackerColumn::Bound{v, inclusive});
+        };
+        std::optional<CrackerColumn::Bound> from, to;
+        if (pred.op == '<'){
+            to = bound(pred.value, false);
+        } else if (pred.op == '>'){
+            from = bound(pred.value, true);
+        } else {
+            from = bound(pred.value, false);
+            to = bound(pred.value_hi, true);
+        }
+
+        size_t covered = 0;
+        {
+            std::lock_guard<std::mutex> guard(crackers->mutex);
+            CrackerColumn& cracker = crackers->columns[pred.col];
+            //rows inserted since the copy was made get scanned, until there are enough of them to start over
+            if (cracker.covered() == 0 || snap.rows - std::min(snap.rows, cracker.covered()) > cracker.covered() / 4){
+                cracker.reset(table2D, pred.col, columnTypes[pred.col], snap.rows);
+            }
+            cracker.select(from, to, rows);
+            covered = cracker.covered();
+        }
+        size_t keep = 0;
+        for (size_t r : rows){
+            if (table2D.visible(r, snap)){
+                rows[keep++] = r;
+            }
+        }
+        rows.resize(keep);
+        std::sort(rows.begin(), rows.end());
+
+        std::vector<size_t> tail;
+        for (size_t r = covered; r < snap.rows; ++r){
+            if (table2D.visible(r, snap)){
+                tail.push_back(r);
+            }
+        }
+        apply_predicate(pred, false, nullptr, snap, tail);
+        rows.insert(rows.end(), tail.begin(), tail.end());
+    }
+
+//rough relative cost of checking pred on one row: cheap scalar compares before strings, equality before ranges
+size_t Table::predicate_cost(const Predicate& pred) const {
+        size_t cost = (columnTypes[pred.col] == EntryType::String) ? 4 : (columnTypes[pred.col] == EntryType::Double) ? 2 : 1;
+        return (pred.op == '=') ? cost : cost + 1;
+    }
+
+void Table::delete_rows(std::istream& is, std::ostream& os){
+        std::string colname;
+        is >> colname; // WHERE
+        std::getline(is, colname);
+        std::istringstream clause(colname);
+
+        WhereClause where;
+        if (!parse_where(clause, "DELETE", where, os)){
+            return;
+        }
+        delete_rows_helper(where, os);
+    }
+
+void Table::delete_rows_helper(const WhereClause& where, std::ostream& os){
+        std::vector<WriteLock> locks = lock_partitions();
+        use_deferred_index(where);
+        std::vector<size_t> killed(num_parts());
+        run_parts(num_parts(), [&](size_t p){
+            killed[p] = part(p).kill_rows(where);
+        });
+        size_t num_rows_deleted = 0;
+        {
+            //a partitioned table's deletes land in every partition at once
+            std::unique_lock<std::mutex> guard(versions->mutex, std::defer_lock);
+            if (partitioned()){
+                guard.lock();
+            }
+            for (size_t p = 0; p < num_parts(); ++p){
+                part(p).publish_deletes(killed[p]);
+                num_rows_deleted += killed[p];
+            }
+        }
+        os << "Deleted " << num_rows_deleted << " rows from " << table_name << '\n';
+
+        //with no reader around the rows go right away, otherwise the last reader out removes them
+        collect_garbage();
+    }
+
+size_t Table::kill_rows(const WhereClause& where){
+        //snapshots taken before the next commit timestamp still see the rows
+        std::vector<size_t> doomed = select_rows(where, true, current_snapshot());
+        uint64_t commit_ts = versions->commit_ts + 1; // only writers move commit_ts, and we hold latch
+        for (size_t r : doomed){
+            table2D.kill(r, commit_ts);
+        }
+        return doomed.size();
+    }
+
+void Table::publish_deletes(size_t count){
+        std::lock_guard<std::mutex> guard(versions->mutex);
+        ++versions->commit_ts;
+        versions->live_rows -= count;
+        versions->tombstones += count;
+        ++versions->version;
+    }
+
+// JOIN <t1> AND <t2> { AND <tK> } WHERE <c1> = <c2> { AND <col> <i> = <cK> } AND PRINT <N> <col> <i> ... { FILTER <i> <clause> }
+// table K (K > 2) joins on its column cK being equal to col of an earlier table i; the FILTERs, on the same
+// line, each restrict table i's rows before it joins
+void SillyQL::join(const std::vector<Table*>& tables, const std::vector<const std::vector<Snapshot>*>& snaps, std::istream& is, std::ostream& os){
+        std::string junk;
+        //the dispatcher read the table names and WHERE
+        auto resolve = [&](const Table& table, const std::string& name, size_t& col){
+            col = table.column_index(name);
+            if (col == table.columnNames.size()){
+                os << "Error during JOIN: " << name << " does not name a column in " << table.table_name << '\n';
+                std::getline(is, junk);
+                return false;
+            }
+            return true;
+        };
+        //a table number as written, 1 to limit, to its index in tables
+        auto table_number = [&](size_t num, size_t limit, size_t& t){
+            if (num == 0 || num > limit){
+                os << "Error during JOIN: " << num << " is not a table number from 1 to " << limit << '\n';
+                std::getline(is, junk);
+                return false;
+            }
+            t = num - 1;
+            return true;
+        };
+
+        std::vector<JoinStep> steps(tables.size() - 1);
+        for (size_t k = 1; k < tables.size(); ++k){
+            JoinStep& step = steps[k - 1];
+            std::string left_name, right_name;
+            size_t left_num = 1;
+            if (k == 1){
+                is >> left_name; // Table 1's column to compare
+                if (!resolve(*tables[0], left_name, step.left_col)){
+                    return;
+                }
+                step.left_table = 0;
+            } else {
+                is >> junk >> left_name >> left_num; // AND <col> <i>
+                if (!table_number(left_num, k, step.left_table) || !resolve(*tables[step.left_table], left_name, step.left_col)){
+                    return;
+                }
+            }
+            is >> junk; // =
+            is >> right_name; // the next table's column to compare
+            if (!resolve(*tables[k], right_name, step.right_col)){
+                return;
+            }
+        }
+
+        is >> junk; // "AND"
+        is >> junk; // "PRINT"
+
+        size_t N; // num of columns to print from all the tables
+        is >> N;
+
+        std::string column_name_to_search;
+        size_t table_num;
+
+        std::vector< std::pair <int, size_t> > cols_ov;
+
+        for (size_t i = 0; i < N; ++i){
+            is >> column_name_to_search;
+            is >> table_num;
+
+            size_t t = 0;
+            size_t col_idx = 0;
+            if (!table_number(table_num, tables.size(), t) || !resolve(*tables[t], column_name_to_search, col_idx)){
+                return;
+            }
+            cols_ov.push_back(std::pair(static_cast<int>(t + 1), col_idx));
+        }
+
+        //FILTER <i> <clause>, any number of them, the rest of the line; two for one table must both hold
+        std::vector<WhereClause> filters(tables.size());
+        if (at_clause(is, "F")){
+            std::string rest_of_line;
+            std::getline(is, rest_of_line);
+            std::istringstream clause(rest_of_line);
+            while (clause >> junk){ // FILTER
+                size_t num = 0, t = 0;
+                clause >> num;
+                if (!table_number(num, tables.size(), t)){
+                    return;
+                }
+                WhereClause filter;
+                if (!tables[t]->parse_where(clause, "JOIN", filter, os)){
+                    return;
+                }
+                if (filters[t].empty()){
+                    filters[t] = std::move(filter);
+                    continue;
+                }
+                //(A1 OR A2) AND (B1 OR B2) is (A1 AND B1) OR (A1 AND B2) OR ...
+                WhereClause both;
+                for (const std::vector<Predicate>& a : filters[t]){
+                    for (const std::vector<Predicate>& b : filter){
+                        both.push_back(a);
+                        for (const Predicate& pred : b){
+                            both.back().push_back(pred);
+                        }
                     }
-                    ++num_rows_printed;
                 }
+                filters[t] = std::move(both);
             }
         }
-        std::cout << "Printed " << num_rows_printed << " rows from joining " << table1.table_name << " to " << table2.table_name << '\n';
+
+        const Table& table1 = *tables[0];
+        if (!table1.quiet){
+            for (size_t i = 0; i < cols_ov.size(); ++i){
+                const Table& output_table = *tables[static_cast<size_t>(cols_ov[i].first - 1)];
+                os << output_table.columnNames[cols_ov[i].second] << " ";
+            }
+            os << '\n';
+        }
+
+        bool filtered = std::any_of(filters.begin(), filters.end(), [](const WhereClause& filter){ return !filter.empty(); });
+        if (filtered || tables.size() > 2){
+            for (size_t t = 0; t < tables.size(); ++t){
+                tables[t]->use_deferred_index(filters[t]);
+            }
+            size_t num_rows_printed = join_chain(tables, snaps, steps, filters, cols_ov, os);
+            os << "Printed " << num_rows_printed << " rows from joining " << table1.table_name;
+            for (size_t t = 1; t < tables.size(); ++t){
+                os << " to " << tables[t]->table_name;
+            }
+            os << '\n';
+            return;
+        }
+
+        const Table& table2 = *tables[1];
+        const std::vector<Snapshot>& snaps1 = *snaps[0];
+        const std::vector<Snapshot>& snaps2 = *snaps[1];
+        size_t tb1_col_to_compare_idx = steps[0].left_col;
+        size_t tb2_col_to_compare_idx = steps[0].right_col;
+
+        //tables partitioned on their join columns the same way only meet partition to partition, so each
+        //pair of partitions is joined on its own; otherwise every part of one side meets every part of the other
+        bool co_partitioned = table1.partitioned() && table2.partitioned() && table1.partitions.size() == table2.partitions.size()
+                && table1.partition_col == tb1_col_to_compare_idx && table2.partition_col == tb2_col_to_compare_idx
+                && table1.columnTypes[tb1_col_to_compare_idx] == table2.columnTypes[tb2_col_to_compare_idx];
+        size_t num_groups = co_partitioned ? table1.partitions.size() : 1;
+        auto side = [&](const Table& table, const std::vector<Snapshot>& snaps, size_t g){
+            std::vector<TablePart> parts;
+            for (size_t p = 0; p < table.num_parts(); ++p){
+                if (!co_partitioned || p == g){
+                    parts.push_back(TablePart{&table.part(p), &snaps[p]});
+                }
+            }
+            return parts;
+        };
+
+        std::vector<size_t> group_rows(num_groups, 0);
+        //nothing gets printed in quiet mode, so only the number of pairs matters
+        if (quietMode){
+            run_parts(num_groups, [&](size_t g){
+                group_rows[g] = join_count(side(table1, snaps1, g), tb1_col_to_compare_idx, side(table2, snaps2, g), tb2_col_to_compare_idx);
+            });
+        } else {
+            //partition pairs print into their own buffers, which go out in partition order
+            std::vector<std::stringstream> group_out(num_groups > 1 ? num_groups : 0);
+            for (std::stringstream& out : group_out){
+                out.copyfmt(os); // bools print as true/false there too
+            }
+            run_parts(num_groups, [&](size_t g){
+                std::ostream& out = (num_groups > 1) ? group_out[g] : os;
+                group_rows[g] = join_rows(side(table1, snaps1, g), tb1_col_to_compare_idx, side(table2, snaps2, g), tb2_col_to_compare_idx, cols_ov, out);
+            });
+            for (std::stringstream& out : group_out){
+                if (out.tellp() > 0){
+                    os << out.rdbuf();
+                }
+            }
+        }
+        size_t num_rows_printed = std::accumulate(group_rows.begin(), group_rows.end(), size_t{0});
+        os << "Printed " << num_rows_printed << " rows from joining " << table1.table_name << " to " << table2.table_name << '\n';
     }// end of join()
 
+size_t SillyQL::join_rows(const std::vector<TablePart>& side1, size_t col1, const std::vector<TablePart>& side2, size_t col2,
+        const std::vector<std::pair<int, size_t>>& cols_ov, std::ostream& os){
+        //generate a hash table for the values of the desired column in each part of table 2
+        std::vector<ProbeTable> join_hash(side2.size());
+        size_t num_keys = 0;
+        for (size_t q = 0; q < side2.size(); ++q){
+            generate_col_idx(*side2[q].table, *side2[q].snap, col2, join_hash[q]);
+            num_keys += join_hash[q].num_keys();
+        }
+        ProbeFilter filter(num_keys);
+        if (filter.active()){
+            for (const ProbeTable& keys : join_hash){
+                for (size_t k = 0; k < keys.num_keys(); ++k){
+                    filter.insert(keys.key(k));
+                }
+            }
+        }
+
+        //late materialization: probing only collects row ids, a batch at a time. Then each output column
+        //is gathered in one pass with prefetches running ahead of it, and only then are rows formatted,
+        //instead of a cache miss per cell while printing
+        static constexpr size_t JOIN_BATCH = 512;
+        static constexpr size_t PREFETCH_AHEAD = 16;
+        struct JoinPair {
+            const RowStore* rows1;
+            size_t row1;
+            const RowStore* rows2;
+            size_t row2;
+        };
+        std::vector<JoinPair> pairs;
+        pairs.reserve(JOIN_BATCH);
+        size_t width = cols_ov.size();
+        std::vector<const TableEntry*> cells(JOIN_BATCH * width); // row-major, the order they're printed in
+
+        auto flush = [&](){
+            for (size_t k = 0; k < width; ++k){
+                bool from_table1 = (cols_ov[k].first == 1);
+                size_t col = cols_ov[k].second;
+                auto cell = [&](const JoinPair& pair){
+                    return from_table1 ? &(*pair.rows1)[pair.row1][col] : &(*pair.rows2)[pair.row2][col];
+                };
+                for (size_t i = 0; i < pairs.size(); ++i){
+                    if (i + PREFETCH_AHEAD < pairs.size()){
+                        __builtin_prefetch(cell(pairs[i + PREFETCH_AHEAD]));
+                    }
+                    cells[i * width + k] = cell(pairs[i]);
+                }
+            }
+            for (size_t i = 0; i < pairs.size(); ++i){
+                for (size_t k = 0; k < width; ++k){
+                    os << *cells[i * width + k] << " ";
+                }
+                os << '\n';
+            }
+            pairs.clear();
+        };
+
+        //table 1's keys probe a batch at a time, every part of table 2 for the whole batch
+        constexpr size_t PROBE_BATCH = ProbeTable::BATCH;
+        const TableEntry* probe_keys[PROBE_BATCH];
+        size_t probe_rows[PROBE_BATCH];
+        std::vector<ProbeTable::Match> matches(side2.size() * PROBE_BATCH);
+        size_t batched = 0;
+        const RowStore* rows1 = nullptr;
+        size_t num_rows_printed = 0;
+        auto probe = [&](){
+            for (size_t q = 0; q < side2.size(); ++q){
+                join_hash[q].probe(probe_keys, batched, &matches[q * PROBE_BATCH]);
+            }
+            for (size_t b = 0; b < batched; ++b){
+                for (size_t q = 0; q < side2.size(); ++q){
+                    const ProbeTable::Match& match = matches[q * PROBE_BATCH + b];
+                    for (const size_t* j = match.begin; j != match.end; ++j){
+                        pairs.push_back(JoinPair{rows1, probe_rows[b], &side2[q].table->table2D, *j});
+                        if (pairs.size() == JOIN_BATCH){
+                            flush();
+                        }
+                    }
+                    num_rows_printed += match.size();
+                }
+            }
+            batched = 0;
+        };
+
+        for (const TablePart& part1 : side1){
+            rows1 = &part1.table->table2D;
+            const Snapshot& snap1 = *part1.snap;
+            SequentialScan scan(*rows1, snap1.rows);
+            for (size_t i = 0; i < snap1.rows; ++i){
+                if (!rows1->visible(i, snap1)){
+                    continue;
+                }
+                const TableEntry& t1val = (*rows1)[i][col1];
+                if (!filter.may_match(t1val)){
+                    continue;
+                }
+                probe_keys[batched] = &t1val;
+                probe_rows[batched] = i;
+                if (++batched == PROBE_BATCH){
+                    probe();
+                }
+            }
+            probe(); // the batch can't carry over, its rows are in this part
+        }
+        flush();
+        return num_rows_printed;
+    }
+
 // helper functions
-void SillyQL::generate_col_idx(const Table& table, size_t column_idx, std::unordered_map<TableEntry, std::vector<size_t>>& umap){
-        for (size_t i = 0; i < table.table2D.size(); ++i){
-            umap[table.table2D[i][column_idx]].emplace_back(i);
+void SillyQL::generate_col_idx(const Table& table, const Snapshot& snap, size_t column_idx, ProbeTable& keys){
+        SequentialScan scan(table.table2D, snap.rows);
+        for (size_t i = 0; i < snap.rows; ++i){
+            if (table.table2D.visible(i, snap)){
+                keys.add(table.table2D[i][column_idx], i);
+            }
         }
+        keys.finish();
     }
 
-void Table::generate(){
+// counts the pairs a JOIN would print: each key contributes (count in table 1) * (count in table 2),
+// so skewed keys cost one multiply instead of one loop iteration per pair
+size_t SillyQL::join_count(const std::vector<TablePart>& side1, size_t col1, const std::vector<TablePart>& side2, size_t col2){
+        //only how many rows each key has matters, not which
+        ProbeTable tb1_keys;
+        for (const TablePart& part1 : side1){
+            const Table& table1 = *part1.table;
+            SequentialScan scan(table1.table2D, part1.snap->rows);
+            for (size_t i = 0; i < part1.snap->rows; ++i){
+                if (table1.table2D.visible(i, *part1.snap)){
+                    tb1_keys.add(table1.table2D[i][col1], i);
+                }
+            }
+        }
+        tb1_keys.finish();
+
+        ProbeFilter filter(tb1_keys.num_keys());
+        if (filter.active()){
+            for (size_t k = 0; k < tb1_keys.num_keys(); ++k){
+                filter.insert(tb1_keys.key(k));
+            }
+        }
+
+        const TableEntry* probe_keys[ProbeTable::BATCH];
+        ProbeTable::Match matches[ProbeTable::BATCH];
+        size_t batched = 0;
+        size_t num_pairs = 0;
+        auto probe = [&](){
+            tb1_keys.probe(probe_keys, batched, matches);
+            for (size_t b = 0; b < batched; ++b){
+                num_pairs += matches[b].size();
+            }
+            batched = 0;
+        };
+        for (const TablePart& part2 : side2){
+            const Table& table2 = *part2.table;
+            SequentialScan scan(table2.table2D, part2.snap->rows);
+            for (size_t j = 0; j < part2.snap->rows; ++j){
+                if (!table2.table2D.visible(j, *part2.snap)){
+                    continue;
+                }
+                const TableEntry& t2val = table2.table2D[j][col2];
+                //keys that table 1 doesn't have can never match
+                if (!filter.may_match(t2val)){
+                    continue;
+                }
+                probe_keys[batched] = &t2val;
+                if (++batched == ProbeTable::BATCH){
+                    probe();
+                }
+            }
+            probe();
+        }
+        return num_pairs;
+    }
+
+size_t SillyQL::join_chain(const std::vector<Table*>& tables, const std::vector<const std::vector<Snapshot>*>& snaps,
+        const std::vector<JoinStep>& steps, const std::vector<WhereClause>& filters,
+        const std::vector<std::pair<int, size_t>>& cols_ov, std::ostream& os){
+        //a table's rows that pass its filter, part by part and in row order within each part; a filter
+        //gets its rows the way a WHERE would (index, cracker or zone mapped scan), no filter is every visible row
+        auto filtered_rows = [&](size_t t){
+            const Table& table = *tables[t];
+            std::vector<std::vector<size_t>> part_rows(table.num_parts());
+            run_parts(table.num_parts(), [&](size_t p){
+                const Table& part = table.part(p);
+                const Snapshot& snap = (*snaps[t])[p];
+                if (filters[t].empty()){
+                    SequentialScan scan(part.table2D, snap.rows);
+                    part_rows[p].reserve(snap.live);
+                    for (size_t r = 0; r < snap.rows; ++r){
+                        if (part.table2D.visible(r, snap)){
+                            part_rows[p].push_back(r);
+                        }
+                    }
+                    return;
+                }
+                ReadLock index_reader(*part.index_latch);
+                part_rows[p] = part.select_rows(filters[t], false, snap);
+                std::sort(part_rows[p].begin(), part_rows[p].end());
+            });
+            std::vector<RowRef> refs;
+            for (size_t p = 0; p < part_rows.size(); ++p){
+                for (size_t r : part_rows[p]){
+                    refs.push_back(RowRef{&table.part(p).table2D, r});
+                }
+            }
+            return refs;
+        };
+
+        //tuples holds the rows joined so far, width of them per result row, one from each table in order;
+        //each stage hashes the next table's rows and probes it with every tuple
+        std::vector<RowRef> tuples = filtered_rows(0);
+        size_t width = 1;
+        size_t num_rows_printed = 0;
+        for (size_t k = 1; k < tables.size() && !tuples.empty(); ++k){
+            const JoinStep& step = steps[k - 1];
+            std::vector<RowRef> right = filtered_rows(k);
+            ProbeTable build; // key -> positions in right
+            for (size_t j = 0; j < right.size(); ++j){
+                build.add(right[j].cell(step.right_col), j);
+            }
+            build.finish();
+            ProbeFilter filter(build.num_keys());
+            if (filter.active()){
+                for (size_t key = 0; key < build.num_keys(); ++key){
+                    filter.insert(build.key(key));
+                }
+            }
+
+            //the last stage prints (or in quiet mode only counts) instead of making tuples;
+            //tuples probe a batch at a time, and each batch is emitted in tuple order
+            bool last = (k + 1 == tables.size());
+            std::vector<RowRef> next;
+            const TableEntry* probe_keys[ProbeTable::BATCH];
+            size_t probe_tuples[ProbeTable::BATCH];
+            ProbeTable::Match matches[ProbeTable::BATCH];
+            size_t batched = 0;
+            auto probe = [&](){
+                build.probe(probe_keys, batched, matches);
+                for (size_t b = 0; b < batched; ++b){
+                    size_t i = probe_tuples[b];
+                    const ProbeTable::Match& match = matches[b];
+                    if (!last){
+                        for (const size_t* j = match.begin; j != match.end; ++j){
+                            next.insert(next.end(), tuples.begin() + static_cast<std::ptrdiff_t>(i), tuples.begin() + static_cast<std::ptrdiff_t>(i + width));
+                            next.push_back(right[*j]);
+                        }
+                        continue;
+                    }
+                    num_rows_printed += match.size();
+                    if (quietMode){
+                        continue;
+                    }
+                    for (const size_t* j = match.begin; j != match.end; ++j){
+                        for (const auto& [table_num, col] : cols_ov){
+                            size_t t = static_cast<size_t>(table_num - 1);
+                            os << ((t < width) ? tuples[i + t] : right[*j]).cell(col) << " ";
+                        }
+                        os << '\n';
+                    }
+                }
+                batched = 0;
+            };
+            for (size_t i = 0; i < tuples.size(); i += width){
+                const TableEntry& key = tuples[i + step.left_table].cell(step.left_col);
+                if (!filter.may_match(key)){
+                    continue;
+                }
+                probe_keys[batched] = &key;
+                probe_tuples[batched] = i;
+                if (++batched == ProbeTable::BATCH){
+                    probe();
+                }
+            }
+            probe();
+            tuples.swap(next);
+            ++width;
+        }
+        return num_rows_printed;
+    }
+
+// keys of a generated index that still have a live row behind them
+template <typename Index>
+static size_t count_live_keys(const RowStore& table2D, const Index& index){
+    size_t keys = 0;
+    for (const auto& bucket : index){
+        for (size_t r : bucket.second){
+            if (table2D.is_live(r)){
+                ++keys;
+                break;
+            }
+        }
+    }
+    return keys;
+}
+
+void Table::generate(std::istream& is, std::ostream& os){
     std::string input_indextype, col_name;
-    std::cin >> input_indextype >> col_name >> col_name >> col_name;
+    is >> input_indextype >> col_name >> col_name >> col_name;
 
     //CHEKCKING IF THE column name exists
-    auto column_it = std::find(columnNames.begin(), columnNames.end(), col_name);
-    if (column_it == columnNames.end()){
-        std::cout << "Error during GENERATE: " << col_name << " does not name a column in " << table_name << '\n';
-        std::getline(std::cin, col_name);
+    size_t column_idx = column_index(col_name);
+    if (column_idx == columnNames.size()){
+        os << "Error during GENERATE: " << col_name << " does not name a column in " << table_name << '\n';
+        std::getline(is, col_name);
         return;
     }
 
+    //BACKGROUND or LAZY on the same line
+    std::string mode;
+    if (at_clause(is, "BL")){
+        is >> mode;
+        if (mode != "BACKGROUND" && mode != "LAZY"){
+            os << "Error during GENERATE: " << mode << " is not one of BACKGROUND, LAZY\n";
+            return;
+        }
+    }
+
     //If an invalid index request is made, do not discard any existing index.
-    if (input_indextype != "hash" && input_indextype != "bst"){
+    if (input_indextype != "hash" && input_indextype != "bst" && input_indextype != "bitmap"){
         return;
     }
 
-    if (index_type != IndexType::NONE){
-        if (index_type == IndexType::HASH){
-            hashTable.clear();
-            bst.clear();
-        } else {
-            bst.clear();
-            hashTable.clear();
+    IndexType type = index_type_named(input_indextype);
+    std::vector<WriteLock> locks = lock_partitions();
+    if (mode == "BACKGROUND"){
+        for (size_t p = 0; p < num_parts(); ++p){
+            part(p).start_index_build(type, column_idx);
+        }
+        os << "Building " << input_indextype << " index for table " << table_name << " on column " << col_name << " in the background\n";
+        return;
+    }
+    if (mode == "LAZY"){
+        for (size_t p = 0; p < num_parts(); ++p){
+            part(p).defer_index(type, column_idx);
         }
+        os << "Deferred " << input_indextype << " index for table " << table_name << " on column " << col_name << " until a WHERE uses it\n";
+        return;
     }
-    
-    //now we initialize the new index depending on if hash or bst
-    size_t column_idx = static_cast<size_t>(std::distance(columnNames.begin(), column_it));
-    col_of_generated_index = column_idx;
-    if (input_indextype == "hash"){
 
-        index_type = IndexType::HASH;
+    std::vector<size_t> part_keys(num_parts());
+    run_parts(num_parts(), [&](size_t p){
+        part_keys[p] = part(p).build_index(type, column_idx);
+    });
+    size_t distinct_keys = part_keys[0];
+    if (partitioned() && column_idx == partition_col){
+        //every key lives in exactly one partition
+        distinct_keys = std::accumulate(part_keys.begin(), part_keys.end(), size_t{0});
+    } else if (partitioned()){
+        std::unordered_set<TableEntry> keys;
+        for (const Table& partition : partitions){
+            partition.live_index_keys(keys);
+        }
+        distinct_keys = keys.size();
+    }
+
+    os << "Created " << input_indextype << " index for table " << table_name << " on column " << 
+    col_name << ", with " << distinct_keys << " distinct keys\n";
+}
+
+void IndexBuild::add_rows(const RowStore& table2D, size_t first, size_t last){
+    if (type == IndexType::HASH){
+        add_postings(table2D, col, first, last, hash);
+    } else if (type == IndexType::BST){
+        add_postings(table2D, col, first, last, bst);
+    } else {
+        add_postings(table2D, col, first, last, bitmaps);
+    }
+}
+
+size_t Table::build_index(IndexType type, size_t column_idx){
+    //the new index is built off to the side, readers keep using the old one until the swap
+    IndexBuild fresh(type, column_idx);
+    fresh.add_rows(table2D, 0, table2D.size());
+    //deleted rows still waiting on a snapshot get postings too, that snapshot may still want them
+    auto live_keys = [&](const auto& index){
+        return (versions->tombstones == 0) ? index.size() : count_live_keys(table2D, index);
+    };
+    size_t distinct_keys = (type == IndexType::HASH) ? live_keys(fresh.hash)
+                         : (type == IndexType::BST) ? live_keys(fresh.bst) : live_keys(fresh.bitmaps);
+
+    WriteLock index_writer(*index_latch);
+    ++index_generation;
+    deferred_index.reset();
+    install_index(index_writer, fresh);
+    return distinct_keys;
+}
+
+void Table::install_index(WriteLock& index_writer, IndexBuild& fresh){
+    hashTable.swap(fresh.hash);
+    bst.swap(fresh.bst);
+    bitmaps.swap(fresh.bitmaps);
+    col_of_generated_index = fresh.col;
+    index_type = fresh.type;
+    can_use_generated_index = (hashTable.size() + bst.size() + bitmaps.size() == 0) ? false : true;
+    index_writer.unlock();
+
+    //rows an index drives a WHERE with come back in its order, so cached PRINT output goes stale
+    std::lock_guard<std::mutex> guard(versions->mutex);
+    ++versions->version;
+}
+
+void Table::start_index_build(IndexType type, size_t column_idx){
+    uint64_t generation = 0;
+    {
+        WriteLock index_writer(*index_latch);
+        generation = ++index_generation;
+        deferred_index.reset();
+    }
+    //the builder's own snapshot keeps the rows it reads where they are
+    acquire_snapshot();
+    index_builder = JoiningThread(std::thread([this, type, column_idx, generation](){
+        try {
+            build_index_aside(type, column_idx, generation);
+        } catch (const std::bad_alloc&) {
+            //no room for the index, the table goes on without it
+        }
+        release_snapshot();
+    }));
+}
+
+void Table::defer_index(IndexType type, size_t column_idx){
+    WriteLock index_writer(*index_latch);
+    ++index_generation;
+    deferred_index = DeferredIndex{type, column_idx};
+}
+
+// builds an index while INSERTs and DELETEs go on: the rows index_rows() had seen when it started are indexed
+// without any latch, then the ones inserted since are added under index_latch right before the swap
+void Table::build_index_aside(IndexType type, size_t column_idx, uint64_t generation){
+    IndexBuild fresh(type, column_idx);
+    size_t covered = 0;
+    {
+        ReadLock index_reader(*index_latch);
+        covered = indexed_rows;
+    }
+    fresh.add_rows(table2D, 0, covered);
+
+    WriteLock index_writer(*index_latch);
+    if (index_generation != generation){
+        return; // another GENERATE came along meanwhile
+    }
+    fresh.add_rows(table2D, covered, indexed_rows);
+    install_index(index_writer, fresh);
+}
+
+void Table::use_deferred_index(const WhereClause& where){
+    if (where.empty()){
+        return;
+    }
+    std::vector<std::optional<DeferredIndex>> claimed(num_parts());
+    std::vector<uint64_t> generations(num_parts());
+    bool any = false;
+    for (size_t p = 0; p < num_parts(); ++p){
+        Table& t = part(p);
+        {
+            ReadLock index_reader(*t.index_latch);
+            if (!t.deferred_index || !t.deferred_index->serves(where)){
+                continue;
+            }
+        }
+        //whoever takes it first builds it, the others scan in the meantime
+        WriteLock index_writer(*t.index_latch);
+        if (t.deferred_index){
+            claimed[p].swap(t.deferred_index);
+            generations[p] = t.index_generation;
+            any = true;
+        }
+    }
+    if (!any){
+        return;
+    }
+    run_parts(num_parts(), [&](size_t p){
+        if (claimed[p]){
+            part(p).build_index_aside(claimed[p]->type, claimed[p]->col, generations[p]);
+        }
+    });
+}
+
+void Table::settle(){
+    adaptive = false;
+    for (size_t p = 0; p < num_parts(); ++p){
+        Table& t = part(p);
+        t.index_builder.join();
+        t.adaptive = false;
+        std::optional<DeferredIndex> deferred;
+        uint64_t generation = 0;
+        {
+            WriteLock index_writer(*t.index_latch);
+            deferred.swap(t.deferred_index);
+            generation = t.index_generation;
+        }
+        if (deferred){
+            t.build_index_aside(deferred->type, deferred->col, generation);
+        }
+    }
+}
+
+// the generated index's keys that still have a live row behind them; the caller holds latch
+void Table::live_index_keys(std::unordered_set<TableEntry>& keys) const {
+    auto add_keys = [&](const auto& index){
+        for (const auto& bucket : index){
+            for (size_t r : bucket.second){
+                if (table2D.is_live(r)){
+                    keys.insert(bucket.first);
+                    break;
+                }
+            }
+        }
+    };
+    if (index_type == IndexType::HASH){
+        add_keys(hashTable);
+    } else if (index_type == IndexType::BST){
+        add_keys(bst);
+    } else if (index_type == IndexType::BITMAP){
+        add_keys(bitmaps);
+    }
+}
+
+// heap bytes behind a string cell, 0 when it fits in the small string buffer
+static size_t heap_string_bytes(const std::string& str){
+    const char* chars = str.data();
+    const char* self = reinterpret_cast<const char*>(&str);
+    bool inline_buffer = (chars >= self && chars < self + sizeof(std::string));
+    return inline_buffer ? 0 : str.capacity() + 1;
+}
+
+static size_t heap_entry_bytes(const TableEntry& entry, EntryType type){
+    return (type == EntryType::String) ? heap_string_bytes(entry.as<std::string>()) : 0;
+}
 
-        for (size_t i = 0; i < table2D.size(); ++i){
-            hashTable[table2D[i][column_idx]].push_back(i);
+MemoryUsage Table::memory_usage() const {
+    MemoryUsage usage;
+    //partitions may be collecting garbage on a reader's thread
+    for (const Table& partition : partitions){
+        ReadLock reader(*partition.latch);
+        usage += partition.memory_usage();
+    }
+    size_t cell_bytes = sizeof(TableEntry) * columnNames.size();
+    usage.data += table2D.size() * cell_bytes;
+    usage.slack += (table2D.capacity() - table2D.size()) * cell_bytes + table2D.overhead_bytes();
+    usage.index += table2D.packed_bytes(); // -p's scan copies, on top of the cells
+
+    for (size_t c = 0; c < columnTypes.size(); ++c){
+        if (columnTypes[c] != EntryType::String){
+            continue;
         }
+        for (size_t r = 0; r < table2D.size(); ++r){
+            usage.strings += heap_string_bytes(table2D[r][c].as<std::string>());
+        }
+    }
 
-        can_use_generated_index = (hashTable.size() == 0) ? false : true;
+    {
+        std::lock_guard<std::mutex> guard(crackers->mutex);
+        for (const auto& [col, cracker] : crackers->columns){
+            usage.index += cracker.used_bytes();
+        }
+    }
 
-    std::cout << "Created hash index for table " << table_name << " on column " << 
-    col_name << ", with " << hashTable.size() << " distinct keys\n";
+    //node sizes are libstdc++'s: rb-tree header or next pointer + cached hash, then the pair
+    constexpr size_t value_bytes = sizeof(TableEntry) + sizeof(std::vector<size_t>);
+    constexpr size_t map_node_bytes = 32 + value_bytes;
+    constexpr size_t hash_node_bytes = 2 * sizeof(void*) + value_bytes;
+    auto count_postings = [&](const TableEntry& key, const std::vector<size_t>& rows){
+        usage.index += rows.size() * sizeof(size_t);
+        usage.slack += (rows.capacity() - rows.size()) * sizeof(size_t);
+        usage.strings += heap_entry_bytes(key, columnTypes[col_of_generated_index]);
+    };
+    if (index_type == IndexType::BST){
+        usage.index += bst.size() * map_node_bytes;
+        for (const auto& bucket : bst){
+            count_postings(bucket.first, bucket.second);
+        }
+    } else if (index_type == IndexType::HASH){
+        //a full bucket array would hold one bucket per key at max_load_factor 1
+        usage.index += hashTable.size() * (hash_node_bytes + sizeof(void*));
+        usage.slack += (hashTable.bucket_count() - std::min(hashTable.bucket_count(), hashTable.size())) * sizeof(void*);
+        for (const auto& bucket : hashTable){
+            count_postings(bucket.first, bucket.second);
+        }
+    } else if (index_type == IndexType::BITMAP){
+        usage.index += bitmaps.size() * (32 + sizeof(TableEntry) + sizeof(RowBitmap));
+        for (const auto& bucket : bitmaps){
+            usage.index += bucket.second.used_bytes();
+            usage.slack += bucket.second.slack_bytes();
+            usage.strings += heap_entry_bytes(bucket.first, columnTypes[col_of_generated_index]);
+        }
+    }
+    return usage;
+}
+
+RowStore::Stats Table::slab_stats() const {
+    RowStore::Stats stats = table2D.stats();
+    for (const Table& partition : partitions){
+        ReadLock reader(*partition.latch);
+        const RowStore::Stats& part_stats = partition.table2D.stats();
+        stats.slab_allocs += part_stats.slab_allocs;
+        stats.slab_frees += part_stats.slab_frees;
+        stats.live_slabs += part_stats.live_slabs;
+        stats.slab_bytes += part_stats.slab_bytes;
+    }
+    return stats;
+}
+
+void Table::compact(){
+    print_cache->clear();
+    for (Table& partition : partitions){
+        WriteLock writer(*partition.latch);
+        partition.compact();
+    }
+    table2D.shrink_to_fit();
+    WriteLock index_writer(*index_latch);
+    if (index_type == IndexType::HASH){
+        hashTable.rehash(0); // back down to the bucket count the current keys need
+        for (auto& bucket : hashTable){
+            bucket.second.shrink_to_fit();
+        }
+    } else if (index_type == IndexType::BST){
+        for (auto& bucket : bst){
+            bucket.second.shrink_to_fit();
+        }
+    } else if (index_type == IndexType::BITMAP){
+        for (auto& bucket : bitmaps){
+            bucket.second.shrink_to_fit();
+        }
+    }
+}
+
+// DELETE leaves spare hash buckets and row list capacity behind; once that's more than
+// everything actually stored (and big enough to matter), give it back
+void Table::compact_if_slack(){
+    static constexpr size_t MIN_SLACK_BYTES = 1 << 20;
+    MemoryUsage usage = memory_usage();
+    if (usage.slack >= MIN_SLACK_BYTES && usage.slack > usage.data + usage.index + usage.strings){
+        compact();
+    }
+}
 
+// folds one column into per-group SUM/MIN/MAX/AVG in a single pass over (row, group) pairs;
+// T is the column's type so the loop never looks at the TableEntry tag
+template <typename T, typename Acc>
+static void fold_column(const RowStore& table2D, size_t col, const std::string& func,
+        const std::vector<size_t>& rows, const std::vector<size_t>& group_of,
+        const std::vector<size_t>& group_first_row, const std::vector<size_t>& counts, std::vector<Acc>& out){
+    if (func == "SUM" || func == "AVG"){
+        out.assign(group_first_row.size(), Acc{});
+        for (size_t i = 0; i < rows.size(); ++i){
+            out[group_of[i]] += table2D[rows[i]][col].as<T>();
+        }
+        if (func == "AVG"){
+            for (size_t g = 0; g < out.size(); ++g){
+                out[g] /= static_cast<Acc>(counts[g]);
+            }
+        }
+        return;
+    }
+
+    //MIN/MAX start from a row that is known to be in the group
+    out.resize(group_first_row.size());
+    for (size_t g = 0; g < group_first_row.size(); ++g){
+        out[g] = table2D[group_first_row[g]][col].as<T>();
+    }
+    bool is_min = (func == "MIN");
+    for (size_t i = 0; i < rows.size(); ++i){
+        T val = table2D[rows[i]][col].as<T>();
+        Acc& best = out[group_of[i]];
+        if (is_min ? (val < best) : (val > best)){
+            best = val;
+        }
+    }
+}
+
+// GROUP FROM <tablename> BY <colname> <N> <AGG1> <colname1> ... <AGGN> <colnameN> ALL|WHERE <clause>
+void Table::group(std::istream& is, std::ostream& os, const std::vector<Snapshot>& snaps){
+    std::string junk, group_col_name;
+    is >> junk >> group_col_name; // BY <colname>
+
+    size_t group_col = column_index(group_col_name);
+    if (group_col == columnNames.size()){
+        os << "Error during GROUP: " << group_col_name << " does not name a column in " << table_name << '\n';
+        std::getline(is, junk);
+        return;
+    }
+
+    size_t N;
+    is >> N;
+    std::vector<Aggregate> aggregates;
+    for (size_t i = 0; i < N; ++i){
+        std::string func, col_name;
+        is >> func >> col_name;
+        size_t col = column_index(col_name);
+        if (col == columnNames.size()){
+            os << "Error during GROUP: " << col_name << " does not name a column in " << table_name << '\n';
+            std::getline(is, junk);
+            return;
+        }
+        if (func != "COUNT" && func != "SUM" && func != "MIN" && func != "MAX" && func != "AVG"){
+            os << "Error during GROUP: " << func << " is not one of COUNT, SUM, MIN, MAX, AVG\n";
+            std::getline(is, junk);
+            return;
+        }
+        if (func != "COUNT" && columnTypes[col] != EntryType::Int && columnTypes[col] != EntryType::Double){
+            os << "Error during GROUP: " << col_name << " is not a numeric column in " << table_name << '\n';
+            std::getline(is, junk);
+            return;
+        }
+        aggregates.push_back(Aggregate{func, col});
+    }
+
+    is >> junk; // WHERE / ALL
+    bool all_rows = (junk == "ALL");
+    std::getline(is, junk);
+    std::istringstream clause(junk);
+    WhereClause where;
+    if (!all_rows && !parse_where(clause, "GROUP", where, os)){
+        return;
+    }
+    use_deferred_index(where);
+
+    //every part groups its own rows; partitions then merge by key, groups numbered by first appearance
+    //in partition order, with AVG carried as a SUM until the counts are in. When every partition's groups
+    //came off a bst (or bitmap) index the merged groups get sorted back into key order, the same order
+    //the index gives an unpartitioned table
+    std::vector<GroupResult> part_groups(num_parts());
+    run_parts(num_parts(), [&](size_t p){
+        part(p).group_rows(where, all_rows, group_col, aggregates, partitioned(), snaps[p], part_groups[p]);
+    });
+
+    GroupResult merged;
+    std::vector<const TableEntry*> keys;
+    if (!partitioned()){
+        merged = std::move(part_groups[0]);
+        for (size_t r : merged.first_rows){
+            keys.push_back(&table2D[r][group_col]);
+        }
     } else {
-        index_type = IndexType::BST;
+        merged.results.resize(aggregates.size());
+        std::unordered_map<TableEntry, size_t> group_ids;
+        for (size_t p = 0; p < partitions.size(); ++p){
+            const GroupResult& part_result = part_groups[p];
+            for (size_t g = 0; g < part_result.counts.size(); ++g){
+                const TableEntry& key = partitions[p].table2D[part_result.first_rows[g]][group_col];
+                auto [it, inserted] = group_ids.try_emplace(key, keys.size());
+                size_t m = it->second;
+                if (inserted){
+                    keys.push_back(&key);
+                    merged.counts.push_back(0);
+                }
+                merged.counts[m] += part_result.counts[g];
+                for (size_t a = 0; a < aggregates.size(); ++a){
+                    const AggregateResult& from = part_result.results[a];
+                    AggregateResult& to = merged.results[a];
+                    to.integral = from.integral;
+                    auto combine = [&](auto& out, const auto& in){
+                        if (inserted){
+                            out.push_back(in[g]);
+                        } else if (aggregates[a].func == "MIN"){
+                            out[m] = std::min(out[m], in[g]);
+                        } else if (aggregates[a].func == "MAX"){
+                            out[m] = std::max(out[m], in[g]);
+                        } else {
+                            out[m] += in[g];
+                        }
+                    };
+                    if (from.integral){
+                        combine(to.ints, from.ints);
+                    } else {
+                        combine(to.reals, from.reals);
+                    }
+                }
+            }
+        }
+        for (size_t a = 0; a < aggregates.size(); ++a){
+            if (aggregates[a].func == "AVG"){
+                for (size_t m = 0; m < merged.counts.size(); ++m){
+                    merged.results[a].reals[m] /= static_cast<double>(merged.counts[m]);
+                }
+            }
+        }
 
-        for (size_t i = 0; i < table2D.size(); ++i){
-            auto it = bst.find(table2D[i][column_idx]);
+        bool key_ordered = std::all_of(part_groups.begin(), part_groups.end(), [](const GroupResult& part_result){
+            return part_result.key_ordered;
+        });
+        if (key_ordered){
+            std::vector<size_t> order(keys.size());
+            std::iota(order.begin(), order.end(), 0);
+            std::sort(order.begin(), order.end(), [&](size_t a, size_t b){
+                return *keys[a] < *keys[b];
+            });
+            auto permute = [&](auto& values){
+                if (values.empty()){
+                    return;
+                }
+                std::remove_reference_t<decltype(values)> sorted;
+                sorted.reserve(values.size());
+                for (size_t m : order){
+                    sorted.push_back(values[m]);
+                }
+                values.swap(sorted);
+            };
+            permute(keys);
+            permute(merged.counts);
+            for (AggregateResult& res : merged.results){
+                permute(res.ints);
+                permute(res.reals);
+            }
+        }
+    }
+    size_t num_groups = keys.size();
+    const std::vector<AggregateResult>& results = merged.results;
 
-            if (it != bst.end()) {
-                it->second.push_back(i);
-            } else {
-                bst[table2D[i][column_idx]] = std::vector<size_t>{i};
+    if (!quiet){
+        os << group_col_name << " ";
+        for (const Aggregate& agg : aggregates){
+            os << agg.func << "(" << columnNames[agg.col] << ") ";
+        }
+        os << '\n';
+        for (size_t g = 0; g < num_groups; ++g){
+            os << *keys[g] << " ";
+            for (const AggregateResult& res : results){
+                if (res.integral){
+                    os << res.ints[g] << " ";
+                } else {
+                    os << res.reals[g] << " ";
+                }
             }
+            os << '\n';
         }
-        can_use_generated_index = (bst.size() == 0) ? false : true;
+    }
+    os << "Printed " << num_groups << " groups from " << table_name << '\n';
+}
 
-        std::cout << "Created bst index for table " << table_name << " on column " << 
-        col_name << ", with " << bst.size() << " distinct keys\n";
+// this table's groups among the rows snap sees; avg_as_sum leaves AVG as a SUM so partitions can be merged
+void Table::group_rows(const WhereClause& where, bool all_rows, size_t group_col, const std::vector<Aggregate>& aggregates,
+        bool avg_as_sum, const Snapshot& snap, GroupResult& out) const {
+    //every selected row paired with its group number, groups numbered in output order
+    std::vector<size_t> rows, group_of, group_first_row;
+    rows.reserve(snap.live);
+    group_of.reserve(snap.live);
+
+    ReadLock index_reader(*index_latch);
+    if (can_use_generated_index && col_of_generated_index == group_col){
+        //the index already has the rows bucketed by key, so no hashing at all
+        std::vector<bool> selected;
+        if (!all_rows){
+            selected.assign(snap.rows, false);
+            for (size_t r : select_rows(where, false, snap)){
+                selected[r] = true;
+            }
+        }
+        auto add_bucket = [&](const auto& postings){
+            bool opened = false;
+            for (size_t r : postings){
+                if (table2D.visible(r, snap) && (all_rows || selected[r])){
+                    if (!opened){
+                        group_first_row.push_back(r);
+                        opened = true;
+                    }
+                    rows.push_back(r);
+                    group_of.push_back(group_first_row.size() - 1);
+                }
+            }
+        };
+
+        out.key_ordered = (index_type == IndexType::BST || index_type == IndexType::BITMAP);
+        if (index_type == IndexType::BST){
+            for (const auto& bucket : bst){
+                add_bucket(bucket.second);
+            }
+        } else if (index_type == IndexType::BITMAP){
+            for (const auto& bucket : bitmaps){
+                add_bucket(bucket.second);
+            }
+        } else {
+            for (const auto& bucket : hashTable){
+                add_bucket(bucket.second);
+            }
+            //hash buckets come out in no particular order, renumber groups by first appearance
+            std::vector<size_t> order(group_first_row.size());
+            for (size_t g = 0; g < order.size(); ++g){
+                order[g] = g;
+            }
+            std::sort(order.begin(), order.end(), [&](size_t a, size_t b){
+                return group_first_row[a] < group_first_row[b];
+            });
+            std::vector<size_t> renumber(order.size());
+            for (size_t g = 0; g < order.size(); ++g){
+                renumber[order[g]] = g;
+            }
+            for (size_t& g : group_of){
+                g = renumber[g];
+            }
+            std::sort(group_first_row.begin(), group_first_row.end());
+        }
+    } else {
+        //hash aggregation, groups numbered by first appearance
+        std::unordered_map<TableEntry, size_t> group_ids;
+        auto visit = [&](size_t r){
+            auto [it, inserted] = group_ids.try_emplace(table2D[r][group_col], group_first_row.size());
+            if (inserted){
+                group_first_row.push_back(r);
+            }
+            rows.push_back(r);
+            group_of.push_back(it->second);
+        };
+        if (all_rows){
+            SequentialScan scan(table2D, snap.rows);
+            for (size_t r = 0; r < snap.rows; ++r){
+                if (table2D.visible(r, snap)){
+                    visit(r);
+                }
+            }
+        } else {
+            for (size_t r : select_rows(where, false, snap)){
+                visit(r);
+            }
+        }
     }
+    index_reader.unlock();
+
+    std::vector<size_t>& counts = out.counts;
+    counts.assign(group_first_row.size(), 0);
+    for (size_t g : group_of){
+        ++counts[g];
+    }
+
+    //one column at a time
+    out.results.assign(aggregates.size(), AggregateResult{});
+    for (size_t a = 0; a < aggregates.size(); ++a){
+        const Aggregate& agg = aggregates[a];
+        AggregateResult& res = out.results[a];
+        std::string func = (avg_as_sum && agg.func == "AVG") ? "SUM" : agg.func;
+        if (agg.func == "COUNT"){
+            res.ints.assign(counts.begin(), counts.end());
+        } else if (columnTypes[agg.col] == EntryType::Int && agg.func != "AVG"){
+            fold_column<int>(table2D, agg.col, func, rows, group_of, group_first_row, counts, res.ints);
+        } else if (columnTypes[agg.col] == EntryType::Int){
+            res.integral = false;
+            fold_column<int>(table2D, agg.col, func, rows, group_of, group_first_row, counts, res.reals);
+        } else {
+            res.integral = false;
+            fold_column<double>(table2D, agg.col, func, rows, group_of, group_first_row, counts, res.reals);
+        }
+    }
+    out.first_rows = std::move(group_first_row);
 }
 
 int main(int argc, char* argv[]){
@@ -942,8 +3615,7 @@ int main(int argc, char* argv[]){
     std::cout << std::boolalpha;
     SillyQL ImFinna;
     ImFinna.get_options(argc, argv);
-    ImFinna.read_input();
-    return 0;
+    return ImFinna.run();
 };  
 
      // for (size_t i = 0; i < table1.table2D.size(); ++i){